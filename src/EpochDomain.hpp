@@ -0,0 +1,543 @@
+/*
+
+Copyright (C) 2016  Blaise Dias
+
+EpochDomain is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+EpochDomain is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with EpochDomain.  If not, see <http://www.gnu.org/licenses/>. *
+*/
+
+#ifndef _EPOCHDOMAIN_HPP_INCLUDED
+#define _EPOCHDOMAIN_HPP_INCLUDED
+#include <stdint.h>
+#include <mutex>
+#include <new>
+#include "HazardPointer.hpp"
+
+namespace benedias {
+namespace concurrent {
+
+template <typename T> class EpochDomain;
+template <typename T> class EpochThreadStates;
+template <typename T> class EpochGuard;
+
+/**
+ * \struct EpochRecord
+ *
+ * Announcement of a thread participating in an EpochDomain.
+ * Each record occupies a cache line of its own, it is written by the
+ * owning thread on entry to and exit from a critical section, and read
+ * by collectors.
+ * Records are claimed by threads, and released on thread exit for reuse
+ * by other threads. Records are deleted with the EpochDomain.
+ */
+struct alignas(HazardSlabMemory::k_LINE) EpochRecord {
+    /// (epoch << 1) | 1 whilst in a critical section, 0 otherwise.
+    uint64_t local = 0;
+    /// Set whilst the record is owned by a thread.
+    bool in_use = true;
+    /// Linked list member for the set of all records.
+    EpochRecord* next = NULL;
+};
+
+/**
+ * \struct EpochLimbo
+ *
+ * A batch of objects retired by a thread, awaiting the epoch to advance.
+ * The batch is tagged with the epoch at which it is handed to the
+ * EpochDomain, which is no earlier than the epoch at which any of its
+ * objects was unlinked.
+ */
+template <typename T> struct EpochLimbo {
+    static const unsigned k_CAPACITY = HazardRetireBatch<T>::k_CAPACITY;
+    typedef typename HazardRetireBatch<T>::Entry Entry;
+    EpochLimbo<T>* next = NULL;
+    uint64_t epoch = 0;
+    unsigned count = 0;
+    Entry entries[k_CAPACITY];
+};
+
+/**
+ * \struct EpochThreadState
+ *
+ * The record and limbo list of a thread for one EpochDomain.
+ */
+template <typename T> struct EpochThreadState {
+    /// Identifier of the EpochDomain, 0 if unused.
+    uint64_t owner_id = 0;
+    EpochDomain<T>* owner = NULL;
+    EpochRecord* record = NULL;
+    /// Critical section nesting depth.
+    unsigned nesting = 0;
+    /// Partially filled batch of objects retired by the thread.
+    EpochLimbo<T>* limbo = NULL;
+};
+
+/**
+ * \class EpochThreadStates
+ *
+ * The set of EpochThreadState instances of a thread, one for each
+ * EpochDomain recently used by the thread.
+ * On thread exit, records are released and limbo lists are handed to
+ * the EpochDomain instances which still exist.
+ * Objects retired to an EpochDomain which no longer exists are deleted,
+ * no thread can be in a critical section of that domain.
+ */
+template <typename T> class EpochThreadStates {
+    static const unsigned k_STATES = 4;
+    EpochThreadState<T> states[k_STATES];
+    /// Next state to evict when all states are in use.
+    unsigned victim = 0;
+
+    void Spill(EpochThreadState<T>& state)
+    {
+        CHECK_ASSERT(state.nesting == 0);
+        if (state.owner_id)
+        {
+            std::lock_guard<std::mutex> lockg(HazardDomainRegistry::Lock());
+            if (HazardDomainRegistry::IsLive(state.owner_id))
+            {
+                if (state.limbo)
+                    state.owner->EnqueueLimbo(state.limbo);
+                state.limbo = NULL;
+                state.owner->ReleaseRecord(state.record);
+            }
+        }
+        if (state.limbo)
+        {
+            for (unsigned ix = 0; ix < state.limbo->count; ++ix)
+                state.limbo->entries[ix].reclaim(state.limbo->entries[ix].object);
+            delete state.limbo;
+            state.limbo = NULL;
+        }
+        state.owner_id = 0;
+        state.owner = NULL;
+        state.record = NULL;
+    }
+
+ public:
+    EpochThreadStates(){}
+    ~EpochThreadStates()
+    {
+        for (unsigned ix = 0; ix < k_STATES; ++ix)
+            Spill(states[ix]);
+    }
+
+    /// Find the state for an EpochDomain, assigning one if required.
+    inline EpochThreadState<T>& Lookup(EpochDomain<T>* owner, uint64_t owner_id)
+    {
+        for (unsigned ix = 0; ix < k_STATES; ++ix)
+        {
+            if (states[ix].owner_id == owner_id)
+                return states[ix];
+        }
+        EpochThreadState<T>* state = NULL;
+        for (unsigned ix = 0; ix < k_STATES && state == NULL; ++ix)
+        {
+            if (states[ix].owner_id == 0)
+                state = &states[ix];
+        }
+        // States of domains in which the thread is in a critical section
+        // cannot be evicted.
+        for (unsigned ix = 0; ix < k_STATES && state == NULL; ++ix)
+        {
+            EpochThreadState<T>* candidate = &states[victim];
+            victim = (victim + 1) % k_STATES;
+            if (candidate->nesting == 0)
+            {
+                Spill(*candidate);
+                state = candidate;
+            }
+        }
+        CHECK_ASSERT(state != NULL);
+        state->owner_id = owner_id;
+        state->owner = owner;
+        state->record = owner->AcquireRecord();
+        return *state;
+    }
+};
+
+/**
+ * \class EpochDomain
+ *
+ * Epoch based reclamation of objects, with the retirement and collection
+ * interface of HazardPointerList.
+ * Readers bracket accesses to shared objects with Enter and Exit,
+ * (see EpochGuard), instead of protecting each object. Entry announces
+ * the current epoch with a store and HazardFence::Light, so it is cheaper
+ * than a hazard pointer per object, but a stalled reader prevents
+ * the reclamation of all objects retired to the domain.
+ *
+ * Retired objects are added to a limbo list private to the thread,
+ * full lists are tagged with the current epoch and handed to the domain.
+ * The collector advances the epoch when every thread in a critical
+ * section has announced the current epoch, and deletes objects whose
+ * tag is at least two epochs old, no thread can still hold a reference
+ * to them.
+ * Collect does not block, and may be invoked by any thread, or by a
+ * CollectorThread.
+ */
+template <typename T> class EpochDomain: public CollectorClientInterface {
+    friend class EpochThreadStates<T>;
+    friend class EpochGuard<T>;
+
+    /// Maximum number of epoch advances attempted by one Collect.
+    static const unsigned k_ADVANCE_ATTEMPTS = 2;
+
+    /// Default function for deleting retired objects.
+    static void DeleteObject(T* obj)
+    {
+        delete obj;
+    }
+
+    /// The global epoch.
+    uint64_t epoch = 0;
+    /// Thread safe linked list of ALL records, records are only added
+    /// concurrently.
+    EpochRecord* records = NULL;
+    /// Thread safe linked list of limbo lists handed to the domain.
+    EpochLimbo<T>* limbo = NULL;
+    /// Number of objects in limbo lists handed to the domain.
+    size_t limbo_count = 0;
+    /// Identifier in the HazardDomainRegistry.
+    uint64_t domain_id = 0;
+
+    // Non copyable.
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+    // Non movable.
+    EpochDomain(EpochDomain&&) = delete;
+    EpochDomain& operator=(EpochDomain&&) = delete;
+
+    /// The state of the calling thread for this instance.
+    inline EpochThreadState<T>& ThreadState()
+    {
+        static thread_local EpochThreadStates<T> states;
+        return states.Lookup(this, domain_id);
+    }
+
+    /// Claim a released record, or allocate one.
+    EpochRecord* AcquireRecord()
+    {
+        for (EpochRecord* rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE);
+                rec; rec = rec->next)
+        {
+            bool expected = false;
+            if (!__atomic_load_n(&rec->in_use, __ATOMIC_RELAXED) &&
+                    __atomic_compare_exchange_n(&rec->in_use, &expected, true,
+                        false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return rec;
+        }
+        EpochRecord* rec = new(HazardSlabMemory::Allocate(sizeof(EpochRecord))) EpochRecord();
+        EpochRecord* desired = rec;
+        rec->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange(&records, &rec->next, &desired,
+                    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+        }
+        return rec;
+    }
+
+    /// Release a record for reuse, the thread is not in a critical section.
+    void ReleaseRecord(EpochRecord* rec)
+    {
+        CHECK_ASSERT(rec->local == 0);
+        __atomic_store_n(&rec->in_use, false, __ATOMIC_RELEASE);
+    }
+
+    /// Thread safe push of a limbo list, tagged with the current epoch.
+    /// \returns the number of objects awaiting deletion.
+    size_t EnqueueLimbo(EpochLimbo<T>* batch)
+    {
+        // The objects were unlinked before this point, the fence orders
+        // the unlinks before the load of the epoch.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        batch->epoch = __atomic_load_n(&epoch, __ATOMIC_RELAXED);
+        size_t count = batch->count;
+        EpochLimbo<T>* desired = batch;
+        batch->next = __atomic_load_n(&limbo, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange(&limbo, &batch->next, &desired,
+                    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+        }
+        return __atomic_add_fetch(&limbo_count, count, __ATOMIC_RELAXED);
+    }
+
+    /// Hand the limbo list of the calling thread to the domain, and
+    /// signal the collector. Without a collector thread the calling
+    /// thread collects.
+    void FlushLimbo(EpochThreadState<T>& state)
+    {
+        EpochLimbo<T>* batch = state.limbo;
+        state.limbo = NULL;
+        EnqueueLimbo(batch);
+        if (collector_thread)
+            collector_thread->Signal(*this);
+        else
+            Collect();
+    }
+
+    /// Advance the epoch, if every thread in a critical section has
+    /// announced the current epoch.
+    /// \returns true if the epoch was advanced, by this or another thread.
+    bool TryAdvance()
+    {
+        uint64_t current = __atomic_load_n(&epoch, __ATOMIC_ACQUIRE);
+        // Pairs with the fence in Enter, a thread entering after this
+        // point sees the objects unlinked before it.
+        HazardFence::Heavy();
+        for (EpochRecord* rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE);
+                rec; rec = rec->next)
+        {
+            uint64_t local = __atomic_load_n(&rec->local, __ATOMIC_ACQUIRE);
+            if ((local & 1) && (local >> 1) != current)
+                return false;
+        }
+        // Failure means another collector has advanced the epoch.
+        __atomic_compare_exchange_n(&epoch, &current, current + 1,
+                false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    inline void Enter(EpochThreadState<T>& state)
+    {
+        if (state.nesting++ == 0)
+        {
+            uint64_t current = __atomic_load_n(&epoch, __ATOMIC_RELAXED);
+            __atomic_store_n(&state.record->local, (current << 1) | 1, __ATOMIC_RELAXED);
+            // Pairs with the fence in TryAdvance.
+            HazardFence::Light();
+        }
+    }
+
+    inline void Exit(EpochThreadState<T>& state)
+    {
+        CHECK_ASSERT(state.nesting > 0);
+        if (--state.nesting == 0)
+            __atomic_store_n(&state.record->local, 0, __ATOMIC_RELEASE);
+    }
+
+    void init()
+    {
+        HazardFence::Register();
+        domain_id = HazardDomainRegistry::Register();
+    }
+
+ public:
+    EpochDomain()
+    {
+        init();
+    }
+
+    explicit EpochDomain(CollectorThread* th_collector)
+    {
+        init();
+        th_collector->RegisterClient(*this);
+    }
+
+    /// EpochDomain destructor is NOT thread safe.
+    /// Clients MUST ensure that no thread is in a critical section, and
+    /// that the EpochDomain is NOT being accessed by other threads.
+    /// All retired objects handed to the domain are deleted, objects in
+    /// the limbo lists of other threads are deleted on exit of those
+    /// threads.
+    ~EpochDomain()
+    {
+        if (collector_thread)
+            collector_thread->DeregisterClient(*this);
+        FlushRetired();
+        // After this, thread states no longer refer to this instance.
+        HazardDomainRegistry::Deregister(domain_id);
+
+        while (limbo)
+        {
+            EpochLimbo<T>* batch = limbo;
+            limbo = batch->next;
+            for (unsigned ix = 0; ix < batch->count; ++ix)
+                batch->entries[ix].reclaim(batch->entries[ix].object);
+            delete batch;
+        }
+        limbo_count = 0;
+        while (records)
+        {
+            EpochRecord* rec = records;
+            records = rec->next;
+            rec->~EpochRecord();
+            HazardSlabMemory::Free(rec, sizeof(EpochRecord));
+        }
+    }
+
+    /// Enter a critical section, objects reachable during the critical
+    /// section are not deleted before it exits. Critical sections nest.
+    inline void Enter()
+    {
+        Enter(ThreadState());
+    }
+
+    /// Exit a critical section.
+    inline void Exit()
+    {
+        Exit(ThreadState());
+    }
+
+    /// \returns true if the calling thread is in a critical section.
+    bool InCriticalSection()
+    {
+        return ThreadState().nesting != 0;
+    }
+
+    /// Retire an object, which is deleted once no thread can hold a
+    /// reference to it. The object must no longer be reachable by other
+    /// threads.
+    void Retire(T* obj)
+    {
+        Retire(obj, &DeleteObject);
+    }
+
+    /// Retire an object, which is deleted by reclaim.
+    /// \param obj the object to retire.
+    /// \param reclaim the function invoked to delete the object.
+    void Retire(T* obj, void (*reclaim)(T*))
+    {
+        EpochThreadState<T>& state = ThreadState();
+        if (state.limbo == NULL)
+            state.limbo = new EpochLimbo<T>();
+        typename EpochLimbo<T>::Entry& entry = state.limbo->entries[state.limbo->count];
+        entry.object = obj;
+        entry.reclaim = reclaim;
+        entry.counted = NULL;
+        entry.bytes = 0;
+        if (++state.limbo->count == EpochLimbo<T>::k_CAPACITY)
+            FlushLimbo(state);
+    }
+
+    /// Hand the partially filled limbo list of the calling thread to the
+    /// domain.
+    void FlushRetired()
+    {
+        EpochThreadState<T>& state = ThreadState();
+        if (state.limbo)
+            FlushLimbo(state);
+    }
+
+    /// Garbage collector function, advances the epoch if possible, and
+    /// deletes objects retired at least two epochs ago.
+    /// Returns false if objects remain to be deleted, true otherwise.
+    bool Collect()
+    {
+        if (RetiredCount() == 0)
+            return true;
+        // All limbo lists are detached in a single exchange.
+        EpochLimbo<T>* batch = __atomic_exchange_n(&limbo, NULL, __ATOMIC_ACQ_REL);
+        if (batch == NULL)
+            return !HaveDeletes();
+        uint64_t oldest = batch->epoch;
+        for (EpochLimbo<T>* b = batch->next; b; b = b->next)
+            oldest = std::min(oldest, b->epoch);
+        for (unsigned attempt = 0; attempt < k_ADVANCE_ATTEMPTS &&
+                oldest + 2 > __atomic_load_n(&epoch, __ATOMIC_ACQUIRE); ++attempt)
+        {
+            if (!TryAdvance())
+                break;
+        }
+
+        uint64_t current = __atomic_load_n(&epoch, __ATOMIC_ACQUIRE);
+        size_t reclaimed = 0;
+        EpochLimbo<T>* keep_first = NULL;
+        EpochLimbo<T>* keep_last = NULL;
+        while (batch)
+        {
+            EpochLimbo<T>* next_batch = batch->next;
+            if (batch->epoch + 2 <= current)
+            {
+                for (unsigned ix = 0; ix < batch->count; ++ix)
+                    batch->entries[ix].reclaim(batch->entries[ix].object);
+                reclaimed += batch->count;
+                delete batch;
+            }
+            else
+            {
+                batch->next = keep_first;
+                keep_first = batch;
+                if (keep_last == NULL)
+                    keep_last = batch;
+            }
+            batch = next_batch;
+        }
+        if (keep_first)
+        {
+            EpochLimbo<T>* desired = keep_first;
+            keep_last->next = __atomic_load_n(&limbo, __ATOMIC_RELAXED);
+            while (!__atomic_compare_exchange(&limbo, &keep_last->next,
+                        &desired, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            {
+            }
+        }
+        __atomic_sub_fetch(&limbo_count, reclaimed, __ATOMIC_RELAXED);
+        return !HaveDeletes();
+    }
+
+    /// \returns true if objects handed to the domain await deletion.
+    bool HaveDeletes()
+    {
+        return RetiredCount() != 0;
+    }
+
+    /// \returns the number of objects handed to the domain awaiting
+    /// deletion.
+    size_t RetiredCount() const
+    {
+        return __atomic_load_n(&limbo_count, __ATOMIC_RELAXED);
+    }
+
+    /// \returns the current epoch.
+    uint64_t Epoch() const
+    {
+        return __atomic_load_n(&epoch, __ATOMIC_RELAXED);
+    }
+};
+
+/**
+ * \class EpochGuard
+ *
+ * Scoped critical section of an EpochDomain.
+ */
+template <typename T> class EpochGuard {
+    EpochDomain<T>& domain;
+    EpochThreadState<T>& state;
+
+    // Non copyable.
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+    // Non movable.
+    EpochGuard(EpochGuard&&) = delete;
+    EpochGuard& operator=(EpochGuard&&) = delete;
+
+ public:
+    static void *operator new(size_t) = delete;
+    static void *operator new[](size_t) = delete;
+
+    explicit EpochGuard(EpochDomain<T>& domain)
+        :domain(domain), state(domain.ThreadState())
+    {
+        domain.Enter(state);
+    }
+
+    ~EpochGuard()
+    {
+        domain.Exit(state);
+    }
+};
+
+} // namespace concurrent
+} // namespace benedias
+#endif  // _EPOCHDOMAIN_HPP_INCLUDED
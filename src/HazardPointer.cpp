@@ -19,11 +19,196 @@ along with Semaphore.  If not, see <http://www.gnu.org/licenses/>. *
 #include <thread>
 #include <atomic>
 #include <chrono>
+#include <unordered_set>
+#include <stdlib.h>
+#include <new>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(SYS_membarrier)
+#include <linux/membarrier.h>
+#endif
 #include "HazardPointer.hpp"
+#include "bdfutex.h"
 
 namespace benedias {
     namespace concurrent {
 
+static std::unordered_set<uint64_t>& live_domains()
+{
+    static std::unordered_set<uint64_t> domains;
+    return domains;
+}
+
+static uint64_t domain_id_value = 0;
+
+uint64_t HazardDomainRegistry::Register()
+{
+    std::lock_guard<std::mutex> lockg(Lock());
+    uint64_t id = ++domain_id_value;
+    live_domains().insert(id);
+    return id;
+}
+
+void HazardDomainRegistry::Deregister(uint64_t id)
+{
+    std::lock_guard<std::mutex> lockg(Lock());
+    live_domains().erase(id);
+}
+
+std::mutex& HazardDomainRegistry::Lock()
+{
+    static std::mutex registry_lock;
+    return registry_lock;
+}
+
+bool HazardDomainRegistry::IsLive(uint64_t id)
+{
+    return live_domains().count(id) != 0;
+}
+
+bool HazardFence::asymmetric = false;
+
+void HazardFence::Register()
+{
+#if defined(SYS_membarrier) && !defined(HAZARD_POINTER_NO_MEMBARRIER)
+    static bool registered = []{
+        long cmds = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0);
+        if (cmds >= 0
+                && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+                && (cmds & MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED)
+                && 0 == syscall(SYS_membarrier,
+                    MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0))
+        {
+            __atomic_store_n(&asymmetric, true, __ATOMIC_SEQ_CST);
+        }
+        return true;
+    }();
+    (void)registered;
+#endif
+}
+
+void HazardFence::Heavy()
+{
+#if defined(SYS_membarrier) && !defined(HAZARD_POINTER_NO_MEMBARRIER)
+    if (IsAsymmetric())
+    {
+        // Readers rely on this, a failure cannot be recovered from.
+        if (0 != syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0))
+            benedias::futex_critical_error(" benedias::concurrent::HazardFence::Heavy membarrier");
+        return;
+    }
+#endif
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static const size_t k_HUGE_PAGE = 2UL * 1024 * 1024;
+
+void* HazardSlabMemory::Allocate(size_t bytes)
+{
+    void* mem;
+    if (bytes >= k_HUGE_PAGE)
+    {
+        // Map an extra huge page, and trim to a huge page aligned block.
+        size_t map_bytes = bytes + k_HUGE_PAGE;
+        char* base = static_cast<char*>(mmap(NULL, map_bytes,
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (base == MAP_FAILED)
+            throw std::bad_alloc();
+        char* aligned = reinterpret_cast<char*>(
+                (reinterpret_cast<uintptr_t>(base) + k_HUGE_PAGE - 1) & ~(k_HUGE_PAGE - 1));
+        if (aligned != base)
+            munmap(base, aligned - base);
+        size_t tail = (base + map_bytes) - (aligned + bytes);
+        if (tail)
+            munmap(aligned + bytes, tail);
+#if defined(MADV_HUGEPAGE)
+        madvise(aligned, bytes, MADV_HUGEPAGE);
+#endif
+        return aligned;
+    }
+    if (posix_memalign(&mem, k_LINE, bytes))
+        throw std::bad_alloc();
+    return mem;
+}
+
+void HazardSlabMemory::Free(void* mem, size_t bytes)
+{
+    if (bytes >= k_HUGE_PAGE)
+        munmap(mem, bytes);
+    else
+        free(mem);
+}
+
+static bool match_scalar(const uintptr_t* hazards, size_t count, uintptr_t ptr)
+{
+    for (size_t ix = 0; ix < count; ++ix)
+    {
+        if (hazards[ix] == ptr)
+            return true;
+    }
+    return false;
+}
+
+#if defined(__x86_64__)
+// SSE2 has no 64 bit compare, both 32 bit halves must match.
+static bool match_sse2(const uintptr_t* hazards, size_t count, uintptr_t ptr)
+{
+    const __m128i key = _mm_set1_epi64x(ptr);
+    size_t ix = 0;
+    for (; ix + 2 <= count; ix += 2)
+    {
+        __m128i eq = _mm_cmpeq_epi32(key,
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(hazards + ix)));
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        if (_mm_movemask_epi8(eq))
+            return true;
+    }
+    return match_scalar(hazards + ix, count - ix, ptr);
+}
+
+__attribute__((target("avx2")))
+static bool match_avx2(const uintptr_t* hazards, size_t count, uintptr_t ptr)
+{
+    const __m256i key = _mm256_set1_epi64x(ptr);
+    size_t ix = 0;
+    for (; ix + 4 <= count; ix += 4)
+    {
+        __m256i eq = _mm256_cmpeq_epi64(key,
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hazards + ix)));
+        if (_mm256_movemask_epi8(eq))
+            return true;
+    }
+    return match_scalar(hazards + ix, count - ix, ptr);
+}
+#endif
+
+typedef bool (*match_fn)(const uintptr_t*, size_t, uintptr_t);
+
+static match_fn select_match()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return match_avx2;
+    return match_sse2;
+#else
+    return match_scalar;
+#endif
+}
+
+bool HazardMatch::Contains(const uintptr_t* hazards, size_t count, uintptr_t ptr)
+{
+    static const match_fn match = select_match();
+    return match(hazards, count, ptr);
+}
+
 /// CollectorClientInterface state transitions
 /// k_UNREGISTERED to k_REGISTERED
 /// k_REGISTERED to k_COLLECTING
@@ -89,6 +274,67 @@ void CollectorThread::DeregisterClient(CollectorClientInterface& client)
     __atomic_store_n(&client.state, k_UNREGISTERED, __ATOMIC_RELEASE);
 }
 
+CollectorClientInterface* CollectorThread::Claim(unsigned& curr_id,
+        size_t min_backlog, bool& skipped)
+{
+    CollectorClientInterface* clientp = NULL;
+    unsigned expected;
+    // Reduce contention on the data lock....
+    // find the first candidate client, change its state to 
+    // collecting and exit the loop.
+    std::lock_guard<std::mutex>  lockg(data_lock);
+    for (unsigned ix_client = 0;
+            (ix_client < clientsID.size()) && (clientp == NULL);
+            ++ix_client)
+    {
+        if (clientsID[ix_client] <= curr_id)
+            continue;
+        curr_id = clientsID[ix_client];
+        if (!__atomic_load_n(&clients[ix_client]->dirty, __ATOMIC_RELAXED))
+            continue;
+        if (clients[ix_client]->RetiredCount() < min_backlog)
+            continue;
+        __atomic_store_n(&clients[ix_client]->dirty, false, __ATOMIC_SEQ_CST);
+        if (!clients[ix_client]->HaveDeletes())
+            continue;
+        expected = k_REGISTERED;
+        if (!__atomic_compare_exchange_n(
+                    &clients[ix_client]->state, &expected, k_COLLECTING,
+                    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            // Being collected by a thread of the pool,
+            // retry after the collection.
+            if (expected == k_COLLECTING)
+            {
+                __atomic_store_n(&clients[ix_client]->dirty, true, __ATOMIC_RELAXED);
+                skipped = true;
+            }
+            CHECK_ASSERT(expected == k_DELETING || expected == k_COLLECTING);
+        }
+        else
+            clientp = clients[ix_client];
+    }
+    return clientp;
+}
+
+bool CollectorThread::CollectClaimed(CollectorClientInterface* clientp)
+{
+    bool complete = clientp->Collect();
+    if (!complete)
+    {
+        // Retry the client after the retry interval.
+        __atomic_store_n(&clientp->dirty, true, __ATOMIC_RELAXED);
+    }
+    unsigned expected = k_COLLECTING;
+    if (!__atomic_compare_exchange_n(
+                    &clientp->state, &expected, k_REGISTERED,
+                    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+        CHECK_ASSERT(false);
+    }
+    return complete;
+}
+
 bool CollectorThread::Collect()
 {
 //    std::lock_guard<std::mutex>  lockg(exec_lock);
@@ -104,53 +350,150 @@ bool CollectorThread::Collect()
     // * recording the client id
     // * performing collect on the client
     // * until we have exhausted all
-    do
+    // A client being collected by another thread of the pool is retried
+    // as an incomplete collection.
+    while (NULL != (clientp = Claim(curr_id, 0, pending)))
     {
-        clientp = NULL;
-        unsigned expected = k_REGISTERED;
-        // Reduce contention on the data lock....
-        // find the first candidate client, change its state to 
-        // collecting and exit the loop.
+        if (!CollectClaimed(clientp))
+            pending = true;
+    }
+    return pending;
+}
+
+bool CollectorThread::Steal(size_t min_backlog, unsigned& curr_id)
+{
+    bool skipped = false;
+    CollectorClientInterface* clientp = Claim(curr_id, min_backlog, skipped);
+    if (clientp == NULL)
+        return false;
+    HAZARD_STAT_ADD(stats.steals, 1);
+    // The owner retries an incomplete collection, and collects objects
+    // retired whilst the client was claimed. An owner waiting to retry
+    // runs its next round after its own interval, waking it would defeat
+    // the increasing retry interval.
+    CollectClaimed(clientp);
+    if (__atomic_load_n(&clientp->dirty, __ATOMIC_SEQ_CST)
+            && !__atomic_load_n(&retrying, __ATOMIC_SEQ_CST))
+        Wake();
+    return true;
+}
+
+size_t CollectorThread::Load()
+{
+    std::lock_guard<std::mutex>  lockg(data_lock);
+    size_t load = 0;
+    for (auto clientp : clients)
+        load += 1 + clientp->RetiredCount();
+    return load;
+}
+
+void CollectorThread::ApplyPlacement()
+{
+    // Placement is advisory, failures are ignored.
+    CollectorPolicy placement = Policy();
+    if (placement.cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(placement.cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    if (placement.sched_idle)
+    {
+        struct sched_param param;
+        param.sched_priority = 0;
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    }
+    else if (placement.nice)
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), placement.nice);
+}
+
+void CollectorThread::Run(CollectorThread* ct)
+{
+    std::chrono::milliseconds retry(0);
+    std::vector<unsigned> steal_ids;
+    ct->ApplyPlacement();
+    while (ct->active)
+    {
+        // Signals from here on are for the next round.
+        __atomic_store_n(&ct->signalled, false, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&ct->busy, true, __ATOMIC_SEQ_CST);
+        HAZARD_STAT_ADD(ct->stats.rounds, 1);
+        bool pending = ct->Collect();
+        // Help the other threads of the pool with large backlogs.
+        if (ct->pool)
         {
-            std::lock_guard<std::mutex>  lockg(data_lock);
-            for (unsigned ix_client = 0;
-                    (ix_client < clientsID.size()) && (clientp == NULL);
-                    ++ix_client)
+            steal_ids.assign(ct->pool->Size(), 0);
+            while (ct->active && ct->pool->Steal(ct, steal_ids))
             {
-                if (clientsID[ix_client] <= curr_id)
-                    continue;
-                curr_id = clientsID[ix_client];
-                if (!clients[ix_client]->HaveDeletes())
-                    continue;
-                expected = k_REGISTERED;
-                if (!__atomic_compare_exchange_n(
-                            &clients[ix_client]->state, &expected, k_COLLECTING,
-                            false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
-                {
-#ifdef  DEBUG                    
-printf("CollectorThread::Collect expected %d\n", expected);
-#endif
-                    CHECK_ASSERT(expected == k_DELETING);
-                }
-                else
-                    clientp = clients[ix_client];
             }
         }
-
-        if (clientp)
+        __atomic_store_n(&ct->busy, false, __ATOMIC_SEQ_CST);
+        if (pending)
         {
-            if (!clientp->Collect())
-                pending = true;
-            expected = k_COLLECTING;
-            if (!__atomic_compare_exchange_n(
-                            &clientp->state, &expected, k_REGISTERED,
-                            false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
-            {
-                CHECK_ASSERT(false);
-            }
+            // Doubling approximates an interval based on the age of the
+            // pending objects, see CollectorPolicy.
+            CollectorPolicy policy = ct->Policy();
+            retry = std::max(policy.min_retry, std::min(retry * 2, policy.max_retry));
+            HAZARD_STAT_ADD(ct->stats.retries, 1);
+            // A signal for new garbage ends the wait early,
+            // the retry interval is retained.
+            __atomic_store_n(&ct->retrying, true, __ATOMIC_SEQ_CST);
+            if (ct->sema.wait_for(retry))
+                HAZARD_STAT_ADD(ct->stats.wakeups, 1);
+            __atomic_store_n(&ct->retrying, false, __ATOMIC_SEQ_CST);
         }
-    }while(clientp);
-    return pending;
+        else
+        {
+            retry = std::chrono::milliseconds(0);
+            ct->sema.wait();
+            HAZARD_STAT_ADD(ct->stats.wakeups, 1);
+        }
+    }
+    ct->thrd = NULL;
+}
+
+void CollectorThread::SetPolicy(const CollectorPolicy& new_policy)
+{
+    std::lock_guard<std::mutex>  lockg(data_lock);
+    policy = new_policy;
+}
+
+CollectorPolicy CollectorThread::Policy()
+{
+    std::lock_guard<std::mutex>  lockg(data_lock);
+    return policy;
+}
+
+CollectorStats CollectorThread::Snapshot() const
+{
+    CollectorStats snapshot;
+    snapshot.rounds = __atomic_load_n(&stats.rounds, __ATOMIC_RELAXED);
+    snapshot.retries = __atomic_load_n(&stats.retries, __ATOMIC_RELAXED);
+    snapshot.wakeups = __atomic_load_n(&stats.wakeups, __ATOMIC_RELAXED);
+    snapshot.signals = __atomic_load_n(&stats.signals, __ATOMIC_RELAXED);
+    snapshot.steals = __atomic_load_n(&stats.steals, __ATOMIC_RELAXED);
+    return snapshot;
+}
+
+void CollectorThread::Signal()
+{
+    {
+        std::lock_guard<std::mutex>  lockg(data_lock);
+        for (auto clientp : clients)
+            __atomic_store_n(&clientp->dirty, true, __ATOMIC_SEQ_CST);
+    }
+    Wake();
+}
+
+void CollectorThread::Signal(CollectorClientInterface& client)
+{
+    __atomic_store_n(&client.dirty, true, __ATOMIC_SEQ_CST);
+    Wake();
+    // A thread busy collecting other clients may take a while to get to
+    // this one, an idle thread of the pool can steal it.
+    if (pool && __atomic_load_n(&busy, __ATOMIC_SEQ_CST))
+        pool->Help(this);
 }
 
 CollectorThread::~CollectorThread()
@@ -166,6 +509,86 @@ CollectorThread::~CollectorThread()
     clientsID.clear();
 }
 
+CollectorPool::CollectorPool(unsigned nthreads, const CollectorPolicy& policy,
+        const std::vector<int>& cpus)
+{
+    if (nthreads == 0)
+        nthreads = 1;
+    // Threads run as they are created, and find the others as they are
+    // published.
+    threads.assign(nthreads, NULL);
+    for (unsigned ix = 0; ix < nthreads; ++ix)
+    {
+        CollectorPolicy thread_policy = policy;
+        if (!cpus.empty())
+            thread_policy.cpu = cpus[ix % cpus.size()];
+        __atomic_store_n(&threads[ix], new CollectorThread(thread_policy, this, ix),
+                __ATOMIC_RELEASE);
+    }
+}
+
+CollectorPool::~CollectorPool()
+{
+    // Threads steal from each other, all are stopped before any is deleted.
+    for (auto thread : threads)
+        thread->Stop(true);
+    for (auto thread : threads)
+        delete thread;
+}
+
+CollectorThread* CollectorPool::Assign()
+{
+    CollectorThread* least = threads[0];
+    size_t least_load = least->Load();
+    for (unsigned ix = 1; ix < threads.size() && least_load; ++ix)
+    {
+        size_t load = threads[ix]->Load();
+        if (load < least_load)
+        {
+            least = threads[ix];
+            least_load = load;
+        }
+    }
+    return least;
+}
+
+bool CollectorPool::Steal(CollectorThread* thief, std::vector<unsigned>& curr_ids)
+{
+    size_t min_backlog = thief->Policy().steal_backlog;
+    unsigned count = threads.size();
+    unsigned start = thief->pool_index;
+    for (unsigned ix = 1; ix < count; ++ix)
+    {
+        unsigned victim = (start + ix) % count;
+        CollectorThread* thread = __atomic_load_n(&threads[victim], __ATOMIC_ACQUIRE);
+        if (thread && thread->Steal(min_backlog, curr_ids[victim]))
+            return true;
+    }
+    return false;
+}
+
+void CollectorPool::Help(CollectorThread* busy)
+{
+    unsigned count = threads.size();
+    unsigned start = busy->pool_index;
+    for (unsigned ix = 1; ix < count; ++ix)
+    {
+        CollectorThread* thread = __atomic_load_n(&threads[(start + ix) % count],
+                __ATOMIC_ACQUIRE);
+        if (thread && !__atomic_load_n(&thread->busy, __ATOMIC_SEQ_CST))
+        {
+            thread->Wake();
+            return;
+        }
+    }
+}
+
+hazard_pointer_domain& hazard_pointer_default_domain()
+{
+    static hazard_pointer_domain domain;
+    return domain;
+}
+
 } // namespace concurrent
 } // namespace benedias
 
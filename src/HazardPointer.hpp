@@ -19,12 +19,17 @@ along with Semaphore.  If not, see <http://www.gnu.org/licenses/>. *
 #ifndef _HAZARDPOINTER_HPP_INCLUDED
 #define _HAZARDPOINTER_HPP_INCLUDED
 #include <assert.h>
+#include <stdint.h>
 #include <atomic>
 #include <thread>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
 #include <mutex>
-#include "Semaphore.hpp"
+#include "semaphore.hpp"
+#include "bdfutex.h"
 
 #define ASSERT_CHECKS   1
 #if     ASSERT_CHECKS
@@ -33,11 +38,132 @@ along with Semaphore.  If not, see <http://www.gnu.org/licenses/>. *
 #define CHECK_ASSERT(x)  void((x))
 #endif
 
+// Counters which are updated on the retire and collect paths, and the
+// collector thread loop, are only maintained if HAZARD_POINTER_STATS is
+// defined, otherwise the updates are elided. The counters exist either
+// way, so the layout of the classes does not depend on the option.
+// It is a build option of the library, set with make DEFS=..., and
+// translation units built without it leave the counters unchanged.
+#if     defined(HAZARD_POINTER_STATS)
+#define HAZARD_STAT_ADD(counter, n)  __atomic_add_fetch(&(counter), (n), __ATOMIC_RELAXED)
+#else
+#define HAZARD_STAT_ADD(counter, n)  do {} while (0)
+#endif
+
 namespace benedias {
 namespace concurrent {
 
 template <typename T> class HazardPointerList;
 template <typename T> class HazardPointer;
+template <typename T, unsigned K> class HazardPointerArray;
+template <typename T> class HazardPointerThreadCaches;
+template <typename T> class hp_snapshot;
+template <typename T, typename D> class hazard_pointer_obj_base;
+class hazard_pointer;
+
+/**
+ * \class HazardDomainRegistry
+ *
+ * Registry of live HazardPointerList instances.
+ * Each instance is assigned a unique identifier, which is never reused.
+ * Per thread state refers to a HazardPointerList by identifier, and on
+ * thread exit, uses the registry to determine if the instance still exists.
+ * Registry lookups are only required on slow paths.
+ */
+class HazardDomainRegistry {
+ public:
+        /// Register a new instance.
+        /// \returns the unique identifier for the instance.
+        static uint64_t Register();
+        /// Deregister an instance, on return no thread is accessing the
+        /// instance under the registry lock.
+        static void Deregister(uint64_t id);
+        /// Lock which must be held whilst accessing an instance which is
+        /// looked up by identifier.
+        static std::mutex& Lock();
+        /// \returns true if the instance is live, the lock must be held.
+        static bool IsLive(uint64_t id);
+};
+
+/**
+ * \class HazardFence
+ *
+ * Fences ordering the publication of a hazard pointer, and the re-load
+ * of its source, against the collector reading the hazard pointers.
+ * This requires a full (StoreLoad) fence on every protection.
+ * If the membarrier system call supports MEMBARRIER_CMD_PRIVATE_EXPEDITED,
+ * the fences are asymmetric, readers only issue a compiler barrier,
+ * and the collector issues membarrier once per scan, which executes
+ * a full fence on every running thread of the process.
+ * Otherwise both sides issue full fences.
+ * Defining HAZARD_POINTER_NO_MEMBARRIER disables asymmetric fences.
+ */
+class HazardFence {
+        static bool asymmetric;
+ public:
+        /// Register the process for expedited membarrier,
+        /// invoked on creation of a HazardPointerList,
+        /// registration is only attempted once.
+        static void Register();
+
+        /// \returns true if the fences are asymmetric.
+        static inline bool IsAsymmetric()
+        {
+            return __atomic_load_n(&asymmetric, __ATOMIC_RELAXED);
+        }
+
+        /// Reader side fence, after publishing a hazard pointer.
+        static inline void Light()
+        {
+            if (IsAsymmetric())
+                __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            else
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        }
+
+        /// Collector side fence, before reading the hazard pointers.
+        static void Heavy();
+};
+
+/// Size of the blocks hazard pointer records are allocated in.
+/// Defining HAZARD_POINTER_HUGE_PAGES selects 2MB blocks, which are
+/// backed by transparent huge pages where available.
+#if defined(HAZARD_POINTER_HUGE_PAGES)
+#define HAZARD_POINTER_SLAB_BYTES   (2UL * 1024 * 1024)
+#else
+#define HAZARD_POINTER_SLAB_BYTES   4096UL
+#endif
+
+/**
+ * \class HazardSlabMemory
+ *
+ * Allocation of cache line aligned blocks for hazard pointer records.
+ * Blocks of a huge page or more are mapped, and advised to use
+ * huge pages.
+ */
+class HazardSlabMemory {
+ public:
+        static const size_t k_LINE = 64;
+        /// Allocate a cache line aligned block, throws std::bad_alloc.
+        static void* Allocate(size_t bytes);
+        static void Free(void* mem, size_t bytes);
+};
+
+/**
+ * \class HazardMatch
+ *
+ * Membership test of a pointer in a small array of pointers, used by
+ * the collector when few pointers are protected.
+ * The comparison is vectorised, using AVX2 or SSE2 as supported by the
+ * processor at run time, with a scalar fallback.
+ */
+class HazardMatch {
+ public:
+        /// Above this many protected pointers, a hash set is used instead.
+        static const size_t k_LINEAR_MAX = 64;
+        /// \returns true if ptr is one of the count values of hazards.
+        static bool Contains(const uintptr_t* hazards, size_t count, uintptr_t ptr);
+};
 
 /**
  * \class HazardPointerNode
@@ -48,20 +174,27 @@ template <typename T> class HazardPointer;
  * Instances of this class can only be created and destroyed by instances
  * of HazardPointerList.
  */
-template <typename T> class HazardPointerNode {
+template <typename T> struct HazardPointerSlab;
+
+template <typename T> class alignas(HazardSlabMemory::k_LINE) HazardPointerNode {
     friend class HazardPointerList<T>;
     friend class HazardPointer<T>;
+    template <typename U, unsigned K> friend class HazardPointerArray;
+    friend class HazardPointerThreadCaches<T>;
 
     /// object pointer
     T*  pointer = reinterpret_cast<T*>(0);
-    T*  gc_pointer = reinterpret_cast<T*>(0);
 
     /// HazardPointerList instance to which this node belongs to.
     HazardPointerList<T>*   owner;
-    /// Linked list member for the fixed list of hazard pointers.
-    HazardPointerNode<T>*   fixed_link;
-    /// Linked list member for the gc and free lists.
+    /// The slab the node was allocated in.
+    HazardPointerSlab<T>*   slab = NULL;
+    /// Linked list member for the free list.
     HazardPointerNode<T>*   next;
+    /// Set by Shrink on nodes on the free list, cleared when the node is
+    /// taken from the free list. Slabs with all nodes still idle on the
+    /// next Shrink are deleted.
+    bool idle = false;
 
     // Non copyable.
     HazardPointerNode(const HazardPointerNode&) = delete;
@@ -103,10 +236,6 @@ template <typename T> class HazardPointerNode {
     inline bool Acquire(T** ptrptr)
     {
         CHECK_ASSERT(IsUnqueued());
-        CHECK_ASSERT(gc_pointer == NULL);
-        
-        if (NULL != gc_pointer)
-            return false;
 #if 0
         if (ptrptr == NULL)
             __atomic_store_n(&pointer, 0x0, __ATOMIC_RELEASE);
@@ -115,43 +244,76 @@ template <typename T> class HazardPointerNode {
 #else
         __atomic_store(&pointer, ptrptr, __ATOMIC_RELEASE);
 #endif
+        HazardFence::Light();
         return true;
     }
 
+    /// Sets the object pointer atomically.
+    /// \param ptr pointer to the object.
+    inline void Protect(T* ptr)
+    {
+        __atomic_store_n(&pointer, ptr, __ATOMIC_RELEASE);
+    }
+
+    /// Publish ptr, the value loaded from src, and confirm that src still
+    /// points to the object.
+    /// The fence orders the publication before the re-load, and pairs with
+    /// the fence in HazardPointerList::Collect, so either the collector
+    /// sees the pointer, or this thread sees the object has been unlinked.
+    /// \param ptr the pointer to protect, on failure updated with the
+    /// current value of src.
+    /// \param src the location the pointer was loaded from.
+    /// \returns true if the object is protected, false if src changed,
+    /// in which case the object pointer is cleared.
+    template <typename U> inline bool TryProtect(U*& ptr, const std::atomic<U*>& src)
+    {
+        U* old = ptr;
+        Protect(old);
+        HazardFence::Light();
+        ptr = src.load(std::memory_order_acquire);
+        if (old == ptr)
+            return true;
+        Clear();
+        return false;
+    }
+
     /// Clears the object pointer.
     /// Functionally equivalent to calling Release,
     /// except that the HazardPointer is still usable.
     inline bool Clear()
     {
-        CHECK_ASSERT(gc_pointer == NULL);
         __atomic_store_n(&pointer, 0x0, __ATOMIC_RELEASE);
         return true;
     }
 
-    /// Releases "protection" on the object pointed to.
+    /// Releases "protection" on the object pointed to,
+    /// and returns the node for reuse.
     /// After this calls to get_pointer will return NULL
+    /// \returns false if no object was protected.
     inline bool Release()
     {
-        CHECK_ASSERT(gc_pointer == NULL);
-        if (NULL == pointer)
-            return false;
-
-        __atomic_store_n(&pointer, 0x0, __ATOMIC_RELEASE);
+        bool was_protecting = (NULL != pointer);
+        if (was_protecting)
+            __atomic_store_n(&pointer, 0x0, __ATOMIC_RELEASE);
         owner->EnqueueFreeRecord(this);
-        return true;
+        return was_protecting;
     }
 
     /// Release "protection" on the object pointed to,
     /// and queues the object for deletion.
+    /// The object is retired to the thread's batch of retired objects,
+    /// and the node is returned for reuse immediately.
+    /// \returns false if no object was protected, the node is not
+    /// returned.
     inline bool Delete()
     {
-        CHECK_ASSERT(gc_pointer == NULL);
-        if (NULL == pointer)
+        T* obj = pointer;
+        if (NULL == obj)
             return false;
 
-        (void)__atomic_exchange(&gc_pointer, &pointer, &pointer, __ATOMIC_ACQ_REL);
-        owner->EnqueueRecordForCollection(this);
-        CHECK_ASSERT(pointer == NULL);
+        owner->RetireDeleted(obj);
+        __atomic_store_n(&pointer, 0x0, __ATOMIC_RELEASE);
+        owner->EnqueueFreeRecord(this);
         return true;
     }
 
@@ -164,6 +326,48 @@ template <typename T> class HazardPointerNode {
 
 };
 
+/**
+ * \struct HazardPointerSlab
+ *
+ * A cache line aligned block of HazardPointerNodes.
+ * Each node occupies a cache line of its own, so a thread publishing a
+ * pointer does not share the line with the pointers of other threads,
+ * and the free list link is only written whilst the node is free.
+ * The collector reads the pointers of a slab as an array with a fixed
+ * stride, rather than chasing links across the heap.
+ * The header occupies the first cache line, and is followed by the nodes.
+ */
+template <typename T> struct alignas(HazardSlabMemory::k_LINE) HazardPointerSlab {
+    /// Maximum number of nodes in a slab.
+    static const unsigned k_NODES =
+        HAZARD_POINTER_SLAB_BYTES / sizeof(HazardPointerNode<T>) - 1;
+    /// Linked list member for the list of slabs.
+    HazardPointerSlab<T>* next = NULL;
+    /// Number of nodes in the slab.
+    unsigned count;
+    /// Nodes on the free list and idle nodes, counted by Shrink.
+    unsigned free_count = 0;
+    unsigned idle_count = 0;
+    /// Set by Shrink on slabs to be deleted.
+    bool reclaim = false;
+    /// Linked list member for slabs unlinked by Shrink, the list link is
+    /// left intact for scans still traversing the slab.
+    HazardPointerSlab<T>* unlinked = NULL;
+
+    explicit HazardPointerSlab(unsigned count):count(count){}
+
+    inline HazardPointerNode<T>* Nodes()
+    {
+        return reinterpret_cast<HazardPointerNode<T>*>(this + 1);
+    }
+
+    /// \returns the size of the allocation for a slab.
+    static inline size_t Bytes(unsigned count)
+    {
+        return sizeof(HazardPointerSlab<T>) + count * sizeof(HazardPointerNode<T>);
+    }
+};
+
 class CollectorThread;
 
 /*
@@ -179,26 +383,85 @@ class CollectorClientInterface {
         /// This variable is atomically updated, by the CollectorThread
         /// class.
         volatile unsigned state = 0;
+        /// Set when the client signals the CollectorThread, and when
+        /// a collection is incomplete, cleared by the CollectorThread
+        /// before collecting, clients which are not dirty are not scanned.
+        volatile bool dirty = false;
         friend class CollectorThread;
 
  protected:
-        /// Lock for serialisation of the Collect function execution.
-        std::recursive_mutex  collector_client_lock;
         /// Pointer to the collector thread this client is registered
         /// with, this field is update by the CollectorThread instance.
         CollectorThread* collector_thread = NULL;
 
  public:
-        /// Garbage collection function
+        /// Garbage collection function, which may be invoked concurrently
+        /// by the collector thread and application threads.
         /// \returns false is garbage collection is incomplete and needs
         /// retrying at some later point, true otherwise.
         virtual bool Collect() = 0;
         /// Garbage collection function
         /// \returns true if items are deletable.
         virtual bool HaveDeletes() = 0;
+        /// \returns the number of retired objects awaiting collection,
+        /// the load the client places on the collector.
+        virtual size_t RetiredCount() const = 0;
         virtual ~CollectorClientInterface(){}
 };
 
+/**
+ * \struct CollectorStats
+ *
+ * Counters of a CollectorThread, only maintained if HAZARD_POINTER_STATS
+ * is defined, otherwise zero.
+ */
+struct CollectorStats {
+    /// Rounds of collection performed.
+    uint64_t rounds = 0;
+    /// Rounds which left a client incomplete, and were retried.
+    uint64_t retries = 0;
+    /// Waits ended by a signal, rather than the retry interval.
+    uint64_t wakeups = 0;
+    /// Posts of the semaphore by signals, coalesced signals are not counted.
+    uint64_t signals = 0;
+    /// Clients collected on behalf of other threads of a pool.
+    uint64_t steals = 0;
+};
+
+/**
+ * \struct CollectorPolicy
+ *
+ * Tuning parameters of a CollectorThread.
+ * When a collection is incomplete, because retired objects are still
+ * protected, the collection is retried after an interval, which doubles
+ * with each consecutive incomplete collection, from min_retry up to
+ * max_retry. Recently retired objects are retried promptly, objects
+ * which remain protected for a long time are retried rarely.
+ * The interval is based on the number of consecutive incomplete rounds
+ * rather than the age of the retired objects, which would need a clock
+ * read for every batch retired. Since the interval doubles, it is about
+ * half the time since the first incomplete round, the age of the oldest
+ * object still awaiting deletion, up to max_retry.
+ */
+struct CollectorPolicy {
+    /// Interval before the first retry of an incomplete collection.
+    std::chrono::milliseconds min_retry = std::chrono::milliseconds(1);
+    /// Maximum interval between retries.
+    std::chrono::milliseconds max_retry = std::chrono::milliseconds(100);
+    /// Threads of a CollectorPool steal clients from each other,
+    /// whose number of retired objects is at least this.
+    size_t steal_backlog = 1024;
+    /// The CPU the thread is bound to, -1 for no binding.
+    int cpu = -1;
+    /// Run the thread with the SCHED_IDLE policy, so reclamation only
+    /// uses otherwise idle CPU time.
+    bool sched_idle = false;
+    /// Nice value of the thread, if sched_idle is not set.
+    int nice = 0;
+};
+
+class CollectorPool;
+
 /*
  * \class CollectorThread
  *
@@ -207,13 +470,14 @@ class CollectorClientInterface {
  *
  * Typically a single instance of this class will be required.
  * Multiple instances may improve collection response time and reduce
- * latency. When collection is required, a client "signals" the instance,
- * and all clients are scanned for collection. If collection was not complete
- * the thread sleeps for 100 milliseconds and retries the collection again.
- * This means that collection is attempted on lists which may not have
- * any objects to be reclaimed. 
- * The main overhead for each of these attempts
- * is the locking required for thread safe operation.
+ * latency. Clients only signal when their retired objects have reached
+ * a threshold, signalling marks the client dirty, and only dirty clients
+ * are scanned for collection.
+ * Signals are coalesced, a client only posts the semaphore if no signal
+ * is outstanding since the thread started its last round of collection,
+ * and the post only makes a wake system call if the thread is waiting.
+ * If objects remain after collection, the collection is retried after an
+ * interval determined by the CollectorPolicy.
  */
 class CollectorThread {
  private:
@@ -222,16 +486,75 @@ class CollectorThread {
         std::mutex  data_lock;
         unsigned id_value = 0;
         volatile bool active = false;
+        /// Set by a signal, cleared by the thread before each round of
+        /// collection.
+        volatile bool signalled = false;
+        /// Set whilst the thread is collecting.
+        volatile bool busy = false;
+        /// Set whilst the thread waits to retry an incomplete collection,
+        /// the thread runs another round without being woken.
+        volatile bool retrying = false;
         std::thread *thrd = NULL;
+        CollectorPolicy policy;
+        CollectorStats stats;
+        /// The pool the thread belongs to, NULL if none.
+        CollectorPool* pool = NULL;
+        /// Index of the thread in the pool.
+        unsigned pool_index = 0;
         bool Collect();
         void CollectOne(CollectorClientInterface& client);
-        BinarySemaphore sema;
+        benedias::semaphore sema;
+        friend class CollectorPool;
+
+        /// Find the next dirty client with an id greater than curr_id,
+        /// and at least min_backlog retired objects, and change its state
+        /// to collecting.
+        /// \param skipped set if a dirty client was skipped, because another
+        /// thread of the pool is collecting it.
+        /// \returns the client, NULL if there is none.
+        CollectorClientInterface* Claim(unsigned& curr_id, size_t min_backlog,
+                bool& skipped);
+        /// Collect a claimed client, and restore its state.
+        /// \returns false if the collection is incomplete.
+        bool CollectClaimed(CollectorClientInterface* clientp);
+        /// Collect one client with at least min_backlog retired objects,
+        /// and an id greater than curr_id, on behalf of this thread,
+        /// called by another thread of the pool. An incomplete collection
+        /// is left to the retry interval of this thread.
+        /// \returns true if a client was collected.
+        bool Steal(size_t min_backlog, unsigned& curr_id);
+        /// \returns the load of the clients of this thread.
+        size_t Load();
+        /// Apply the CPU binding and scheduling of the policy to the
+        /// calling thread.
+        void ApplyPlacement();
+
+        /// Post the semaphore, unless a signal is already outstanding.
+        void Wake()
+        {
+            if (!__atomic_exchange_n(&signalled, true, __ATOMIC_SEQ_CST))
+            {
+                HAZARD_STAT_ADD(stats.signals, 1);
+                sema.post();
+            }
+        }
 
  public:
         /// On construction a thread is created, which runs the 
         /// collect fuction for each HazardPointerList registered
         /// with this instance of CollectorThread.
-        CollectorThread()
+        /// \param policy the retry policy.
+        explicit CollectorThread(const CollectorPolicy& policy = CollectorPolicy())
+            :policy(policy)
+        {
+            active = true;
+            thrd = new std::thread(Run, this);
+        }
+
+        /// Constructor for thread index of a CollectorPool.
+        CollectorThread(const CollectorPolicy& policy, CollectorPool* pool,
+                unsigned index)
+            :policy(policy), pool(pool), pool_index(index)
         {
             active = true;
             thrd = new std::thread(Run, this);
@@ -248,19 +571,16 @@ class CollectorThread {
         /// \param client the client to deregister from the collector.
         void DeregisterClient(CollectorClientInterface& client);
 
-        static void Run(CollectorThread* ct)
-        {
-            while (ct->active)
-            {
-                if (ct->Collect())
-                {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                    ct->sema.Post();
-                }
-                ct->sema.Wait();
-            }
-            ct->thrd = NULL;
-        }
+        /// Replace the policy, takes effect from the next retry.
+        void SetPolicy(const CollectorPolicy& new_policy);
+
+        /// \returns the current policy.
+        CollectorPolicy Policy();
+
+        /// \returns the counters, the fields are read individually.
+        CollectorStats Snapshot() const;
+
+        static void Run(CollectorThread* ct);
 
         /// Stops the collector thread.
         /// \param join default false, it true this function returns
@@ -268,297 +588,1768 @@ class CollectorThread {
         void Stop(bool join=false)
         {
             active = false;
-            Signal();
+            sema.post();
             if (join && (thrd != NULL))
                 thrd->join();
         }
 
-        /// Signal the collector thread, that work needs to be done.
-        void Signal()
-        {
-            sema.Post();
-        }
+        /// Signal the collector thread, that client has work to be done.
+        void Signal(CollectorClientInterface& client);
+
+        /// Signal the collector thread, that all clients are to be scanned.
+        void Signal();
 };
 
 /**
- * \class HazardPointerList
+ * \class CollectorPool
  *
- * This class implements the management for hazard pointers.
- * Typically a single instance of this class is required for each 
- * set of objects to be protected or container class.
+ * A fixed number of CollectorThreads, to scale reclamation across a few
+ * CPUs when there are many clients.
+ * Clients are sharded across the threads, each client is registered with
+ * the thread with the least load when it is created, see Assign.
+ * A thread which has completed its own round of collection steals dirty
+ * clients with large backlogs from the other threads, each at most once per
+ * round, and a signal to a busy thread wakes an idle thread to do so.
+ * A client is only collected by one thread at a time, so registration and
+ * deregistration are safe whilst collections run.
+ * All clients must be destroyed before the pool.
  */
-template <typename T> class HazardPointerList: public CollectorClientInterface {
-    friend class HazardPointerNode<T>;
+class CollectorPool {
+ private:
+        std::vector<CollectorThread*> threads;
+        friend class CollectorThread;
 
-    /// Ending node for all lists, all links point to itself.
-    HazardPointerNode<T>*  end_node;
+        /// Collect a client of another thread on behalf of thief.
+        /// \param curr_ids the id of the client last stolen from each
+        /// thread, a client is stolen at most once per round of thief.
+        /// \returns true if a client was collected.
+        bool Steal(CollectorThread* thief, std::vector<unsigned>& curr_ids);
+        /// Wake an idle thread to steal from busy.
+        void Help(CollectorThread* busy);
 
-    /// Thread safe linked list of ALL hazard pointer records,
-    /// never deleted from.
-    /// This list is only ever added to, and this restriction facilitates
-    /// concurrency, but nevertheless is  major limitation of this implementation.
-    HazardPointerNode<T>*   nodes = end_node;
-    /// Thread safe linked list of hazard pointer records to be collected.
-    HazardPointerNode<T>*   gc_list = end_node;
-    /// Thread safe linked list of hazard pointer records that are free.
-    HazardPointerNode<T>*   free_list = end_node;
+ public:
+        // Non copyable.
+        CollectorPool(const CollectorPool&) = delete;
+        CollectorPool& operator=(const CollectorPool&) = delete;
+        // Non movable.
+        CollectorPool(CollectorPool&&) = delete;
+        CollectorPool& operator=(const CollectorPool&&) = delete;
+
+        /// Constructor.
+        /// \param nthreads the number of threads.
+        /// \param policy the policy of each thread.
+        /// \param cpus if not empty, thread n is bound to cpus[n % size],
+        /// overriding the cpu of the policy.
+        explicit CollectorPool(unsigned nthreads,
+                const CollectorPolicy& policy = CollectorPolicy(),
+                const std::vector<int>& cpus = std::vector<int>());
+
+        ~CollectorPool();
+
+        /// \returns the thread with the least load, to register a new
+        /// client with, for example
+        /// HazardPointerList<T> hplist(pool.Assign());
+        CollectorThread* Assign();
+
+        /// \returns the number of threads.
+        unsigned Size() const
+        {
+            return threads.size();
+        }
+
+        /// \returns thread ix of the pool.
+        CollectorThread& Thread(unsigned ix)
+        {
+            return *threads[ix];
+        }
+};
+
+/**
+ * \class HazardRefCounted
+ *
+ * Base class for objects which may be referenced for longer than a
+ * hazard pointer should be held, for example across blocking operations.
+ * A hazard pointer protecting the object is promoted to a counted
+ * reference, a HazardRef, and the hazard pointer is free for reuse.
+ * Collect does not delete a retired object whilst its count is non zero,
+ * the object remains retired and is reconsidered by later scans.
+ * Objects which are never promoted pay only for the count.
+ */
+class HazardRefCounted {
+    template <typename T> friend class HazardRef;
 
-    std::vector<T*>  all_haz_ptrs;
+    unsigned long refs = 0;
 
-    /// Add a new HazardPointerNode to the set of nodes belonging to
-    /// this HazardPointerList.
-    /// \param node the node to add.
-    void Add(HazardPointerNode<T>* node)
+    void AddRef()
     {
-        HazardPointerNode<T>* desired;
-        do
-        {
-            node->fixed_link = nodes;
-            desired = node;
-        }while (!__atomic_compare_exchange(
-                    &nodes, &node->fixed_link, &desired,
-                    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+        __atomic_add_fetch(&refs, 1, __ATOMIC_RELAXED);
     }
 
-    /// Thread safe push a node onto either one of the free or gc list.
-    /// \param node the node to push.
-    /// \param head pointer to the head node of the list.
-    void push(HazardPointerNode<T>* node, HazardPointerNode<T>** head)
+    /// Release orders the accesses made through the reference before
+    /// the deletion of the object by Collect.
+    void DropRef()
     {
-        CHECK_ASSERT(node->IsUnqueued());
-        HazardPointerNode<T>* desired;
-        do
-        {
-            node->next = *head;
-            desired = node;
-        }while (!__atomic_compare_exchange(head, &node->next, &desired,
-                   false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+        __atomic_sub_fetch(&refs, 1, __ATOMIC_RELEASE);
     }
 
-    /// Thread safe remove of a node from the free or gc list.
-    /// In practice this function is only called to remove items from
-    /// the gc list.
-    /// \param node the node to remove.
-    /// \param head pointer to the head node of the list.
-    void remove(HazardPointerNode<T>* node, HazardPointerNode<T>** head)
+ protected:
+    HazardRefCounted(){}
+    // The count belongs to the instance, and is not copied.
+    HazardRefCounted(const HazardRefCounted&){}
+    HazardRefCounted& operator=(const HazardRefCounted&){ return *this; }
+    ~HazardRefCounted(){}
+
+ public:
+    /// \returns the number of counted references.
+    unsigned long RefCount() const
     {
-        while (true)
-        {
-            HazardPointerNode<T>** ppnode = head;
-            while (*ppnode != node && *ppnode != end_node)
-            {
-                ppnode = &((*ppnode)->next);
-            }
-            if (*ppnode == end_node)
-            {
-                CHECK_ASSERT(false);
-                return;
-            }
-            HazardPointerNode<T>* expected = *ppnode;
-            HazardPointerNode<T>* desired = expected->next;
-            if (__atomic_compare_exchange(ppnode, &expected, &desired,
-                        false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
-            {
-                /// Record that the node is not on the gc or free list.
-                node->next = NULL;
-                return;
-            }
-        }
+        return __atomic_load_n(&refs, __ATOMIC_ACQUIRE);
     }
+};
 
-    /// Thread safe pop of a node from the free or gc list.
-    /// \param head pointer to the head node of the list.
-    HazardPointerNode<T>* pop(HazardPointerNode<T>** head)
+/// \returns the counted base of obj, NULL if the type of obj is not
+/// derived from HazardRefCounted.
+inline const HazardRefCounted* HazardCounted(const HazardRefCounted* obj)
+{
+    return obj;
+}
+
+inline const HazardRefCounted* HazardCounted(const void*)
+{
+    return NULL;
+}
+
+/// The number of bytes accounted for a retired object of type T, against
+/// the garbage limit of a HazardPointerList. Memory owned by the object
+/// is not included.
+template <typename T> struct HazardObjectBytes {
+    static const size_t value = sizeof(T);
+};
+
+template <> struct HazardObjectBytes<void> {
+    static const size_t value = 0;
+};
+
+/**
+ * \class HazardRef
+ *
+ * A counted reference to an object derived from HazardRefCounted,
+ * created by promoting a hazard pointer.
+ * The object is not deleted whilst a reference exists, the reference
+ * may be held for any length of time, but must not outlive the
+ * HazardPointerList the object was retired to.
+ * Instances are copyable and movable, a default constructed or moved from
+ * instance is empty.
+ */
+template <typename T> class HazardRef {
+    friend class HazardPointer<T>;
+    friend class hazard_pointer;
+
+    T* ptr = NULL;
+
+    /// Constructor, only valid whilst obj is protected by a hazard pointer.
+    explicit HazardRef(T* obj):ptr(obj)
     {
-        HazardPointerNode<T>* node;
-        HazardPointerNode<T>* desired;
-        do
-        {
-            node = *head;
-            desired = node->next;
-        }while(!__atomic_compare_exchange(head, &node, &desired,
-                    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
-        if (node != end_node)
-        {
-            /// Record that the node is not on the gc or free list.
-            node->next = NULL;
-        }
-        return node;
+        static_cast<HazardRefCounted*>(ptr)->AddRef();
     }
 
-    /// Enqueue a record on the free list.
-    /// \param node the newly "freed" node.
-    inline void EnqueueFreeRecord(HazardPointerNode<T>* node)
+ public:
+    HazardRef(){}
+
+    HazardRef(const HazardRef& other):ptr(other.ptr)
     {
-        CHECK_ASSERT(node->IsUnqueued());
-        CHECK_ASSERT(node->pointer == NULL);
-        push(node, &free_list);
+        if (ptr)
+            static_cast<HazardRefCounted*>(ptr)->AddRef();
     }
 
-    /// Enqueued a record on the gc list.
-    /// \param node the node scheduled for garbage collection.
-    inline void EnqueueRecordForCollection(HazardPointerNode<T>* node)
+    HazardRef(HazardRef&& other):ptr(other.ptr)
     {
-        CHECK_ASSERT(node->IsUnqueued());
-        CHECK_ASSERT(node->pointer == NULL);
-        CHECK_ASSERT(node->gc_pointer != NULL);
-        push(node, &gc_list);
-        if (collector_thread)
-        {
-            collector_thread->Signal();
-        }
+        other.ptr = NULL;
     }
 
-    void init()
+    HazardRef& operator=(HazardRef other)
     {
-        end_node = new HazardPointerNode<T>(this);
-        end_node->fixed_link = end_node;
-        end_node->next = end_node;
-        nodes = end_node;
-        gc_list = end_node;
-        free_list = end_node;
+        std::swap(ptr, other.ptr);
+        return *this;
     }
 
- public:
-    HazardPointerList()
+    ~HazardRef()
     {
-        init();
+        reset();
     }
 
-    explicit HazardPointerList(CollectorThread* th_collector)
+    /// Drop the reference, the instance is empty.
+    void reset()
     {
-        init();
-        th_collector->RegisterClient(*this);
+        if (ptr)
+            static_cast<HazardRefCounted*>(ptr)->DropRef();
+        ptr = NULL;
     }
 
-    /// HazardPointerList destructor is non trivial and NOT thread safe.
-    /// Clients MUST ensure that the HazardPointerList is NOT being accessed
-    /// by other threads.
-    /// To prevent leaks all objects in the gclist MUST be deleted.
-    /// Release is invoked on all nodes not in the free or gc lists,
-    /// and the nodes are deleted.
-    /// This will leave associated HazardPointer instances with dangling
-    /// pointers. One fix would be to maintain a list of all associated
-    /// HazardPointer instances, and invalidate them here.
-    /// That would be complex and expensive.
-    /// For now program structure and sequencing must work around this 
-    /// limitation.
-    ~HazardPointerList()
-    {
-        if (collector_thread)
-            collector_thread->DeregisterClient(*this);
+    T* get() const { return ptr; }
+    T& operator*() const { return *ptr; }
+    T* operator->() const { return ptr; }
+    explicit operator bool() const { return ptr != NULL; }
+};
+
+/**
+ * \struct HazardRetireBatch
+ *
+ * A batch of retired objects of one HazardPointerList.
+ * Batches are filled privately by a thread, and a full batch is handed
+ * to the HazardPointerList in a single atomic push.
+ * The collector compacts the objects which are still protected in place,
+ * no per object list manipulation is required.
+ */
+template <typename T> struct HazardRetireBatch {
+    static const unsigned k_CAPACITY = 64;
+    /// A retired object, the function which deletes it, its counted
+    /// base, NULL if the object is not reference counted, and the bytes
+    /// accounted for it.
+    struct Entry {
+        T* object;
+        void (*reclaim)(T*);
+        const HazardRefCounted* counted;
+        size_t bytes;
+    };
+    HazardRetireBatch<T>* next = NULL;
+    unsigned count = 0;
+    /// Sum of the bytes of the entries.
+    size_t bytes = 0;
+    /// Time the first object was retired to the batch, only set if
+    /// HAZARD_POINTER_STATS is defined.
+    uint64_t retired_ns = 0;
+    Entry entries[k_CAPACITY];
+};
 
-        HazardPointerNode<T>* node = nodes;
-        while(node != end_node)
+/**
+ * \class HazardPointerNodeCache
+ *
+ * Cache of free HazardPointerNodes of one HazardPointerList,
+ * private to a thread.
+ * Nodes are chained using the free list link, the chain is
+ * terminated by the end node of the HazardPointerList.
+ */
+template <typename T> struct HazardPointerNodeCache {
+    /// Identifier of the HazardPointerList, 0 if unused.
+    uint64_t owner_id = 0;
+    HazardPointerList<T>* owner = NULL;
+    HazardPointerNode<T>* head = NULL;
+    unsigned count = 0;
+    /// Partially filled batch of objects retired by the thread.
+    HazardRetireBatch<T>* retired = NULL;
+    /// Objects the thread may retire at the garbage limit before it
+    /// next collects.
+    size_t help_credit = 0;
+};
+
+/**
+ * \class HazardPointerThreadCaches
+ *
+ * The set of HazardPointerNodeCache instances of a thread,
+ * one for each HazardPointerList recently used by the thread.
+ * On thread exit, cached nodes and retired objects are returned to the
+ * HazardPointerList instances which still exist.
+ * Objects retired to a HazardPointerList which no longer exists are
+ * deleted, no hazard pointer can be protecting them.
+ */
+template <typename T> class HazardPointerThreadCaches {
+    static const unsigned k_CACHES = 4;
+    HazardPointerNodeCache<T> caches[k_CACHES];
+    /// Next cache to evict when all caches are in use.
+    unsigned victim = 0;
+
+    /// Return the cached nodes to the owner, if it still exists.
+    void Spill(HazardPointerNodeCache<T>& cache)
+    {
+        if (cache.owner_id)
         {
-            if (node->pointer)
-                node->Release();
-            node = node->fixed_link;
+            std::lock_guard<std::mutex> lockg(HazardDomainRegistry::Lock());
+            if (HazardDomainRegistry::IsLive(cache.owner_id))
+            {
+                if (cache.count)
+                    cache.owner->SpillCache(cache, cache.count);
+                if (cache.retired)
+                    cache.owner->EnqueueBatchForCollection(cache.retired);
+                cache.retired = NULL;
+            }
         }
-
-        Collect();
-        gc_list = end_node;
-        free_list = end_node;
-        node = nodes;
-        nodes = end_node;
-        while (node != end_node)
+        if (cache.retired)
         {
-            HazardPointerNode<T>*   del_node = node;
-            node = node->fixed_link;
-            delete del_node;
+            for (unsigned ix = 0; ix < cache.retired->count; ++ix)
+                cache.retired->entries[ix].reclaim(cache.retired->entries[ix].object);
+            delete cache.retired;
+            cache.retired = NULL;
         }
-        delete end_node;
+        cache.owner_id = 0;
+        cache.owner = NULL;
+        cache.head = NULL;
+        cache.count = 0;
+        cache.help_credit = 0;
     }
 
-    /// Add nodes to the free list.
-    /// One strategy to avoid blocking on HazardPointerNode acquisition
-    /// is to "prime" the free list by adding nodes to it.
-    /// Working out an optimal value for an application requires
-    ///  1) foreknowledge of the (maximum) number of threads 
-    ///  2) foreknowledge of the number of Hazard Pointers used by each thread.
-    ///  3) a guaranteed object collection rate.
-    /// The 3rd is non trivial to arrange, especially when collection occurs asynchronously
-    /// in another thread.
-    /// An alternatively is to use a non-blocking allocator.
-    void Prime(size_t node_count)
+ public:
+    HazardPointerThreadCaches(){}
+    ~HazardPointerThreadCaches()
     {
-        while (node_count--)
-        {
-            HazardPointerNode<T>* node = new HazardPointerNode<T>(this);
-            Add(node);
-            push(node, &free_list);
-        }
+        for (unsigned ix = 0; ix < k_CACHES; ++ix)
+            Spill(caches[ix]);
     }
 
-    /// Acquire a hazard pointer record.
-    /// The "new" record may be a "recycled" instance or created anew which may 
-    /// block on memory allocation.
-    HazardPointerNode<T>*  AcquireNode()
+    /// Find the cache for a HazardPointerList, assigning one if required.
+    inline HazardPointerNodeCache<T>& Lookup(HazardPointerList<T>* owner,
+            uint64_t owner_id)
     {
-        HazardPointerNode<T>* node = pop(&free_list);
-        if (node == end_node)
+        for (unsigned ix = 0; ix < k_CACHES; ++ix)
         {
-            node = NULL;
-            node = new HazardPointerNode<T>(this);
-            Add(node);
+            if (caches[ix].owner_id == owner_id)
+                return caches[ix];
         }
-        return node;
-    }
-
-    /// Garbage collector function, objects which have been scheduled for
-    /// deletion, are safely deleted by this function.
-    /// The function is thread safe, at any one time only one thread may
-    /// execute this function, other threads will be blocked.
-    /// Returns true if all objects scheduled for delete, have been deleted
-    /// false otherwise.
-    bool Collect()
-    {
-        if (gc_list == end_node)
-            return false;
-
-        std::lock_guard<std::recursive_mutex> lockg(collector_client_lock);
-
-        HazardPointerNode<T> *node = nodes;
-        while (node != end_node)
+        HazardPointerNodeCache<T>* cache = NULL;
+        for (unsigned ix = 0; ix < k_CACHES && cache == NULL; ++ix)
         {
-            if (node->pointer)
-                all_haz_ptrs.push_back(node->pointer);
-            node = node->fixed_link;
+            if (caches[ix].owner_id == 0)
+                cache = &caches[ix];
         }
-        std::sort(all_haz_ptrs.begin(), all_haz_ptrs.end());
-
-        HazardPointerNode<T> *gc_node = gc_list;
-        while (gc_node != end_node)
+        if (cache == NULL)
         {
-            CHECK_ASSERT(NULL != gc_node);
-            HazardPointerNode<T> *next_gc_node = gc_node->next;
-
-            T *obj_ptr = gc_node->gc_pointer;
-            CHECK_ASSERT(NULL != obj_ptr);
-            CHECK_ASSERT(NULL == gc_node->pointer);
-            if (!std::binary_search(all_haz_ptrs.begin(),
-                        all_haz_ptrs.end(),
-                        obj_ptr))
-            {
-                __atomic_store_n(&gc_node->gc_pointer, 0x0, __ATOMIC_RELEASE);
-                delete obj_ptr;
-#ifdef  DEBUG                
-printf("***** Collect:Deleted %p\n", obj_ptr);
-#endif
-                remove(gc_node, &gc_list);
-                CHECK_ASSERT(node->pointer == NULL);
-                push(gc_node, &free_list);
-            }
-            gc_node = next_gc_node;
+            cache = &caches[victim];
+            victim = (victim + 1) % k_CACHES;
+            Spill(*cache);
         }
-
-        all_haz_ptrs.clear();
-        return gc_list == end_node;
+        cache->owner_id = owner_id;
+        cache->owner = owner;
+        return *cache;
+    }
+};
+
+/// Behaviour of HazardPointerList::AcquireNode when the node limit
+/// has been reached, and no free node is available.
+enum class HazardNodePolicy {
+    /// Wait for a node to be freed.
+    k_BLOCK,
+    /// Allocate a node regardless, Shrink deletes nodes in excess of the
+    /// limit once they are freed.
+    k_FALLBACK,
+    /// Return NULL, the HazardPointer is unbound and Acquire fails.
+    k_FAIL,
+};
+
+/// Behaviour of HazardPointerList::Retire when the garbage limit has
+/// been reached.
+/// A thread collects at most once per batch of objects it retires at
+/// the limit.
+enum class HazardGarbagePolicy {
+    /// Collect, and retire regardless.
+    k_HELP,
+    /// Collect, until the retired objects are within the limit.
+    k_BLOCK,
+    /// Collect, if still at the limit do not retire, Retire returns false.
+    k_FAIL,
+};
+
+/**
+ * \class HazardPointerSet
+ *
+ * Open addressing hash set of the pointers protected by hazard pointers,
+ * rebuilt by HazardPointerList::Collect for each scan.
+ * The table is retained between scans, so once sized, scans do not
+ * allocate, and each membership test is O(1).
+ */
+template <typename T> class HazardPointerSet {
+    std::vector<T*> table;
+    size_t mask = 0;
+    size_t count = 0;
+
+    static inline size_t Hash(T* ptr)
+    {
+        uint64_t h = (uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15ULL;
+        return (size_t)(h >> 32);
+    }
+
+    void Grow()
+    {
+        std::vector<T*> old(std::max<size_t>(16, 2 * table.size()), NULL);
+        old.swap(table);
+        mask = table.size() - 1;
+        count = 0;
+        for (T* ptr : old)
+        {
+            if (ptr)
+                Insert(ptr);
+        }
+    }
+
+ public:
+    /// Empty the set, sizing the table for expected entries at a load
+    /// factor of at most one half.
+    void Clear(size_t expected)
+    {
+        size_t capacity = 16;
+        while (capacity < 2 * expected)
+            capacity <<= 1;
+        if (capacity > table.size() || 4 * capacity < table.size())
+            table.assign(capacity, NULL);
+        else
+            std::fill(table.begin(), table.end(), (T*)NULL);
+        mask = table.size() - 1;
+        count = 0;
+    }
+
+    void Insert(T* ptr)
+    {
+        if (2 * (count + 1) > table.size())
+            Grow();
+        size_t ix = Hash(ptr) & mask;
+        while (table[ix] != NULL)
+        {
+            if (table[ix] == ptr)
+                return;
+            ix = (ix + 1) & mask;
+        }
+        table[ix] = ptr;
+        ++count;
+    }
+
+    bool Contains(T* ptr) const
+    {
+        if (count == 0)
+            return false;
+        size_t ix = Hash(ptr) & mask;
+        while (table[ix] != NULL)
+        {
+            if (table[ix] == ptr)
+                return true;
+            ix = (ix + 1) & mask;
+        }
+        return false;
+    }
+};
+
+/**
+ * \struct HazardScanStats
+ *
+ * Cumulative cost of the scans performed by HazardPointerList::Collect,
+ * to facilitate tuning of the scan threshold.
+ */
+struct HazardScanStats {
+    /// Number of scans performed.
+    uint64_t scans = 0;
+    /// Number of hazard pointer records examined.
+    uint64_t nodes_scanned = 0;
+    /// Number of retired objects examined.
+    uint64_t retired_scanned = 0;
+    /// Number of retired objects deleted.
+    uint64_t reclaimed = 0;
+    /// Total duration of all scans in nanoseconds.
+    uint64_t scan_ns = 0;
+    /// Duration of the most recent scan in nanoseconds.
+    uint64_t last_scan_ns = 0;
+};
+
+/**
+ * \struct HazardLatencyHistogram
+ *
+ * Histogram of the time from retirement to deletion of objects, with
+ * power of two buckets. Objects are timed from the retirement of the
+ * first object of their batch, so times are an upper bound.
+ */
+struct HazardLatencyHistogram {
+    static const unsigned k_BUCKETS = 32;
+    /// Bucket n counts objects deleted 2^n to 2^(n+1) microseconds after
+    /// retirement, bucket 0 also counts those deleted within a microsecond.
+    uint64_t buckets[k_BUCKETS] = {};
+
+    /// \returns the bucket for a latency.
+    static unsigned Bucket(uint64_t latency_us)
+    {
+        if (latency_us == 0)
+            return 0;
+        unsigned bucket = 63 - __builtin_clzll(latency_us);
+        return bucket < k_BUCKETS ? bucket : k_BUCKETS - 1;
+    }
+};
+
+/**
+ * \struct HazardDomainStats
+ *
+ * Snapshot of the state of a HazardPointerList, see
+ * HazardPointerList::Snapshot. The gauges and scan costs are always
+ * available, the remaining counters only if HAZARD_POINTER_STATS is
+ * defined, otherwise they are zero.
+ */
+struct HazardDomainStats {
+    /// Number of hazard pointer records.
+    size_t nodes = 0;
+    /// Number of records on the free list.
+    size_t free_nodes = 0;
+    /// Number of objects awaiting deletion.
+    size_t retired = 0;
+    /// Bytes accounted for the objects awaiting deletion.
+    size_t retired_bytes = 0;
+    /// Number of objects handed to the HazardPointerList for deletion,
+    /// including those inline collection deleted immediately.
+    uint64_t objects_retired = 0;
+    /// Cost of scans, and objects deleted.
+    HazardScanStats scans;
+    /// Retirement to deletion latency.
+    HazardLatencyHistogram latency;
+};
+
+/// \returns a monotonic time in nanoseconds, for statistics.
+inline uint64_t HazardNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * \class HazardPointerList
+ *
+ * This class implements the management for hazard pointers.
+ * Typically a single instance of this class is required for each 
+ * set of objects to be protected or container class.
+ */
+template <typename T> class HazardPointerList: public CollectorClientInterface {
+    friend class HazardPointerNode<T>;
+    friend class HazardPointerThreadCaches<T>;
+    template <typename U, unsigned K> friend class HazardPointerArray;
+    friend class hp_snapshot<T>;
+    template <typename U, typename D> friend class hazard_pointer_obj_base;
+
+    /// Number of nodes moved between a thread cache and the free list
+    /// at a time.
+    static const unsigned k_CACHE_BATCH = 8;
+    /// Maximum number of nodes in a thread cache.
+    static const unsigned k_CACHE_MAX = 2 * k_CACHE_BATCH;
+    /// Default scan threshold, a multiple of the number of hazard pointer
+    /// records, and a minimum.
+    static const size_t k_SCAN_FACTOR = 2;
+    static const size_t k_SCAN_MINIMUM = 64;
+    /// Maximum number of empty batches of retired objects pooled.
+    static const unsigned k_BATCH_POOL_MAX = 64;
+
+    /// Default function for deleting retired objects.
+    static void DeleteObject(T* obj)
+    {
+        delete obj;
+    }
+
+    /// Ending node for all lists, all links point to itself.
+    HazardPointerNode<T>*  end_node;
+
+    /// Thread safe linked list of the slabs of ALL hazard pointer records.
+    /// Concurrently slabs are only added, idle slabs are removed
+    /// by Shrink, with the collector lock and the free list lock held.
+    HazardPointerSlab<T>*   slabs = NULL;
+    /// Thread safe linked list of hazard pointer records that are free.
+    HazardPointerNode<T>*   free_list = end_node;
+    /// Thread safe linked list of batches of retired objects.
+    HazardRetireBatch<T>*   retire_batches = NULL;
+    /// Pool of empty batches, pushed by the collector.
+    HazardRetireBatch<T>*   batch_pool = NULL;
+    /// Number of batches in the pool.
+    unsigned batch_pool_count = 0;
+    /// Serialises removal of batches from the pool.
+    std::mutex batch_pool_lock;
+
+    /// Number of hazard pointer records belonging to this instance.
+    size_t node_count = 0;
+    /// Number of records on the free list, incremented before a push and
+    /// decremented after a removal, so never less than the actual number.
+    size_t free_nodes = 0;
+    /// Number of objects awaiting deletion in batches.
+    size_t retired_count = 0;
+    /// Bytes accounted for the objects awaiting deletion in batches.
+    size_t retired_bytes = 0;
+    /// Limits on the objects and bytes awaiting deletion, 0 for no limit.
+    size_t garbage_objects_limit = 0;
+    size_t garbage_bytes_limit = 0;
+    HazardGarbagePolicy garbage_policy = HazardGarbagePolicy::k_HELP;
+    /// Number of threads waiting in LimitGarbage for the retired objects
+    /// to be within the limits.
+    int garbage_waiters = 0;
+    /// If non zero, the number of objects in a thread's batch at which the
+    /// thread scans its own batch, see SetInlineCollect.
+    unsigned inline_threshold = 0;
+    /// Retired objects are only scanned for when there are at least
+    /// max(scan_factor * hazard pointer records not on the free list,
+    /// scan_minimum) of them,
+    /// so that each scan reclaims a number of objects proportional to
+    /// its cost.
+    size_t scan_factor = k_SCAN_FACTOR;
+    size_t scan_minimum = k_SCAN_MINIMUM;
+    /// Shrink retains at least node_retain nodes.
+    size_t node_retain = 0;
+    /// Maximum number of nodes, 0 for no limit.
+    size_t node_limit = 0;
+    HazardNodePolicy node_policy = HazardNodePolicy::k_FALLBACK;
+    /// Number of threads waiting in AcquireNode for a node.
+    int node_waiters = 0;
+    /// Notified when nodes are pushed onto the free list, or deleted.
+    eventcount node_available;
+    /// Pointers protected at the time of a scan, retained across scans.
+    std::vector<uintptr_t> hazard_ptrs;
+    /// Hash set of hazard_ptrs, when there are too many for HazardMatch.
+    HazardPointerSet<T>  hazards;
+    HazardScanStats scan_stats;
+    /// Counters, only maintained if HAZARD_POINTER_STATS is defined.
+    uint64_t objects_retired = 0;
+    HazardLatencyHistogram latency;
+
+    /// Identifier in the HazardDomainRegistry.
+    uint64_t domain_id = 0;
+    /// Number of Collect calls reading the hazard pointers.
+    unsigned active_scans = 0;
+    /// Slabs unlinked by Shrink, deleted once no scan is active.
+    HazardPointerSlab<T>* unlinked_slabs = NULL;
+    /// Serialises Shrink.
+    std::mutex shrink_lock;
+    /// Held by the Collect call using the retained scratch buffers.
+    std::mutex scratch_lock;
+    /// Serialises removal of nodes from the free list, pushes are lock free.
+    /// With a single remover at any time, removal is not subject to
+    /// the ABA problem.
+    std::mutex free_list_lock;
+
+    /// Allocate a slab of nodes, and add it to the set of slabs belonging
+    /// to this HazardPointerList. The nodes are chained in order,
+    /// the last node is linked to the end node.
+    /// \param count the number of nodes, already counted in node_count.
+    HazardPointerSlab<T>* NewSlab(unsigned count)
+    {
+        void* mem = HazardSlabMemory::Allocate(HazardPointerSlab<T>::Bytes(count));
+        HazardPointerSlab<T>* slab = new(mem) HazardPointerSlab<T>(count);
+        HazardPointerNode<T>* node = slab->Nodes();
+        for (unsigned ix = 0; ix < count; ++ix)
+        {
+            new(&node[ix]) HazardPointerNode<T>(this);
+            node[ix].slab = slab;
+            node[ix].next = ix + 1 < count ? &node[ix + 1] : end_node;
+        }
+        HazardPointerSlab<T>* desired = slab;
+        slab->next = __atomic_load_n(&slabs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange(&slabs, &slab->next, &desired,
+                    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+        }
+        return slab;
+    }
+
+    /// Delete a slab, which has been removed from the set of slabs.
+    static void DeleteSlab(HazardPointerSlab<T>* slab)
+    {
+        unsigned count = slab->count;
+        HazardPointerNode<T>* node = slab->Nodes();
+        for (unsigned ix = 0; ix < count; ++ix)
+            node[ix].~HazardPointerNode<T>();
+        slab->~HazardPointerSlab<T>();
+        HazardSlabMemory::Free(slab, HazardPointerSlab<T>::Bytes(count));
+    }
+
+    /// Reserve up to count nodes in node_count, subject to the node limit.
+    /// \returns the number of nodes reserved, 0 if the limit has been
+    /// reached.
+    size_t ReserveNodes(size_t count)
+    {
+        size_t limit = __atomic_load_n(&node_limit, __ATOMIC_RELAXED);
+        size_t current = __atomic_load_n(&node_count, __ATOMIC_RELAXED);
+        size_t reserve;
+        do
+        {
+            reserve = count;
+            if (limit && current >= limit)
+                return 0;
+            if (limit && limit - current < reserve)
+                reserve = limit - current;
+        }while (!__atomic_compare_exchange_n(&node_count, &current,
+                    current + reserve, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+        return reserve;
+    }
+
+    /// Allocate a slab of nodes, subject to the node limit and policy.
+    /// The first node is returned, the remainder are pushed onto the
+    /// free list.
+    HazardPointerNode<T>* NewNode(HazardPointerNodeCache<T>& cache)
+    {
+        size_t count = ReserveNodes(HazardPointerSlab<T>::k_NODES);
+        if (count == 0)
+        {
+            switch (__atomic_load_n(&node_policy, __ATOMIC_RELAXED))
+            {
+                case HazardNodePolicy::k_FAIL:
+                    return NULL;
+                case HazardNodePolicy::k_BLOCK:
+                    if (0 == (count = WaitNode(cache)))
+                        return PopCache(cache);
+                    break;
+                case HazardNodePolicy::k_FALLBACK:
+                    count = HazardPointerSlab<T>::k_NODES;
+                    __atomic_add_fetch(&node_count, count, __ATOMIC_RELAXED);
+                    break;
+            }
+        }
+        HazardPointerSlab<T>* slab = NewSlab(count);
+        HazardPointerNode<T>* node = slab->Nodes();
+        if (count > 1)
+        {
+            __atomic_add_fetch(&free_nodes, count - 1, __ATOMIC_RELAXED);
+            push_chain(&node[1], &node[count - 1], &free_list);
+            node_available.fence_and_notify();
+        }
+        node->next = NULL;
+        return node;
+    }
+
+    /// Wait until a node is available on the free list, or nodes can
+    /// be allocated within the limit.
+    /// \returns 0 if the thread cache was refilled, otherwise the number
+    /// of nodes reserved.
+    size_t WaitNode(HazardPointerNodeCache<T>& cache)
+    {
+        size_t reserved = 0;
+        __atomic_add_fetch(&node_waiters, 1, __ATOMIC_SEQ_CST);
+        while (true)
+        {
+            int key = node_available.prepare_wait();
+            if (RefillCache(cache) ||
+                    0 != (reserved = ReserveNodes(HazardPointerSlab<T>::k_NODES)))
+            {
+                node_available.cancel_wait();
+                break;
+            }
+            node_available.commit_wait(key);
+        }
+        __atomic_sub_fetch(&node_waiters, 1, __ATOMIC_RELAXED);
+        return reserved;
+    }
+
+    /// Take a node from the thread cache, which must not be empty.
+    inline HazardPointerNode<T>* PopCache(HazardPointerNodeCache<T>& cache)
+    {
+        HazardPointerNode<T>* node = cache.head;
+        cache.head = node->next == end_node ? NULL : node->next;
+        --cache.count;
+        /// Record that the node is not on the free list.
+        node->next = NULL;
+        return node;
+    }
+
+    /// Thread safe push a node onto the free list.
+    /// \param node the node to push.
+    /// \param head pointer to the head node of the list.
+    void push(HazardPointerNode<T>* node, HazardPointerNode<T>** head)
+    {
+        CHECK_ASSERT(node->IsUnqueued());
+        HazardPointerNode<T>* desired;
+        do
+        {
+            node->next = *head;
+            desired = node;
+        }while (!__atomic_compare_exchange(head, &node->next, &desired,
+                   false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    }
+
+    /// Unlink a node from the free list, only a single thread
+    /// removes nodes at any time, concurrent pushes only change the head.
+    /// \param head pointer to the head node of the list.
+    /// \param prev the node preceding node, NULL if node was the head
+    /// when the list was traversed.
+    /// \param node the node to unlink.
+    /// \returns the node now preceding the successor of node.
+    HazardPointerNode<T>* unlink(HazardPointerNode<T>** head,
+            HazardPointerNode<T>* prev, HazardPointerNode<T>* node)
+    {
+        HazardPointerNode<T>* next = node->next;
+        if (prev == NULL)
+        {
+            HazardPointerNode<T>* expected = node;
+            if (__atomic_compare_exchange(head, &expected, &next,
+                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                return NULL;
+            }
+            // Nodes have been pushed since the traversal started,
+            // node is now preceded by one of those.
+            prev = expected;
+            while (prev->next != node)
+                prev = prev->next;
+        }
+        __atomic_store_n(&prev->next, next, __ATOMIC_RELEASE);
+        return prev;
+    }
+
+    /// Thread safe push of a chain of nodes onto the free list.
+    /// \param first the first node of the chain.
+    /// \param last the last node of the chain.
+    /// \param head pointer to the head node of the list.
+    void push_chain(HazardPointerNode<T>* first, HazardPointerNode<T>* last,
+            HazardPointerNode<T>** head)
+    {
+        HazardPointerNode<T>* desired;
+        do
+        {
+            last->next = *head;
+            desired = first;
+        }while (!__atomic_compare_exchange(head, &last->next, &desired,
+                   false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    }
+
+    /// The thread cache of free nodes for this instance.
+    inline HazardPointerNodeCache<T>& ThreadCache()
+    {
+        static thread_local HazardPointerThreadCaches<T> caches;
+        return caches.Lookup(this, domain_id);
+    }
+
+    /// Move up to k_CACHE_BATCH nodes from the free list to a thread cache.
+    /// \returns false if the free list is empty.
+    bool RefillCache(HazardPointerNodeCache<T>& cache)
+    {
+        std::lock_guard<std::mutex> lockg(free_list_lock);
+        HazardPointerNode<T>* first;
+        HazardPointerNode<T>* last;
+        HazardPointerNode<T>* desired;
+        unsigned count;
+        first = __atomic_load_n(&free_list, __ATOMIC_ACQUIRE);
+        do
+        {
+            if (first == end_node)
+                return false;
+            // Concurrent pushes only change the head, so the chain
+            // following the head is stable.
+            last = first;
+            count = 1;
+            while (count < k_CACHE_BATCH && last->next != end_node)
+            {
+                last = last->next;
+                ++count;
+            }
+            desired = last->next;
+        }while (!__atomic_compare_exchange(&free_list, &first, &desired,
+                    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+        __atomic_sub_fetch(&free_nodes, count, __ATOMIC_RELAXED);
+        for (HazardPointerNode<T>* node = first; node != last; node = node->next)
+            node->idle = false;
+        last->idle = false;
+        last->next = cache.head ? cache.head : end_node;
+        cache.head = first;
+        cache.count += count;
+        return true;
+    }
+
+    /// Move nodes from a thread cache to the free list.
+    /// \param cache the thread cache.
+    /// \param count the number of nodes to move.
+    void SpillCache(HazardPointerNodeCache<T>& cache, unsigned count)
+    {
+        HazardPointerNode<T>* first = cache.head;
+        HazardPointerNode<T>* last = first;
+        for (unsigned ix = 1; ix < count; ++ix)
+            last = last->next;
+        cache.head = last->next == end_node ? NULL : last->next;
+        cache.count -= count;
+        __atomic_add_fetch(&free_nodes, count, __ATOMIC_RELAXED);
+        push_chain(first, last, &free_list);
+        node_available.fence_and_notify();
+    }
+
+    /// Enqueue a record on the free list.
+    /// The record is added to the thread cache, which spills a batch to
+    /// the free list when full.
+    /// \param node the newly "freed" node.
+    inline void EnqueueFreeRecord(HazardPointerNode<T>* node)
+    {
+        CHECK_ASSERT(node->IsUnqueued());
+        CHECK_ASSERT(node->pointer == NULL);
+        if (__atomic_load_n(&node_waiters, __ATOMIC_SEQ_CST))
+        {
+            // Bypass the thread cache, other threads are waiting for nodes.
+            __atomic_add_fetch(&free_nodes, 1, __ATOMIC_RELAXED);
+            push(node, &free_list);
+            node_available.fence_and_notify();
+            return;
+        }
+        HazardPointerNodeCache<T>& cache = ThreadCache();
+        node->next = cache.head ? cache.head : end_node;
+        cache.head = node;
+        if (++cache.count > k_CACHE_MAX)
+            SpillCache(cache, k_CACHE_BATCH);
+    }
+
+    /// Enqueue records on the free list, with a single thread cache lookup.
+    /// \param nodes the newly "freed" nodes.
+    /// \param count the number of nodes.
+    void EnqueueFreeRecords(HazardPointerNode<T>* const* nodes, unsigned count)
+    {
+        if (__atomic_load_n(&node_waiters, __ATOMIC_SEQ_CST))
+        {
+            for (unsigned ix = 0; ix < count; ++ix)
+                EnqueueFreeRecord(nodes[ix]);
+            return;
+        }
+        HazardPointerNodeCache<T>& cache = ThreadCache();
+        for (unsigned ix = 0; ix < count; ++ix)
+        {
+            HazardPointerNode<T>* node = nodes[ix];
+            CHECK_ASSERT(node->IsUnqueued());
+            CHECK_ASSERT(node->pointer == NULL);
+            node->next = cache.head ? cache.head : end_node;
+            cache.head = node;
+        }
+        cache.count += count;
+        while (cache.count > k_CACHE_MAX)
+            SpillCache(cache, k_CACHE_BATCH);
+    }
+
+    /// Take an empty batch from the pool, or allocate one.
+    HazardRetireBatch<T>* AcquireBatch()
+    {
+        HazardRetireBatch<T>* batch = NULL;
+        if (__atomic_load_n(&batch_pool, __ATOMIC_RELAXED) != NULL)
+        {
+            std::lock_guard<std::mutex> lockg(batch_pool_lock);
+            batch = __atomic_load_n(&batch_pool, __ATOMIC_ACQUIRE);
+            // Single remover, so not subject to the ABA problem.
+            while (batch && !__atomic_compare_exchange(&batch_pool, &batch,
+                        &batch->next, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+            }
+            if (batch)
+            {
+                __atomic_sub_fetch(&batch_pool_count, 1, __ATOMIC_RELAXED);
+                batch->next = NULL;
+                batch->count = 0;
+                batch->bytes = 0;
+            }
+        }
+        if (batch == NULL)
+            batch = new HazardRetireBatch<T>();
+#if     defined(HAZARD_POINTER_STATS)
+        batch->retired_ns = HazardNowNs();
+#endif
+        return batch;
+    }
+
+    /// Return an empty batch to the pool, deleting it if the pool is full.
+    void ReleaseBatch(HazardRetireBatch<T>* batch)
+    {
+        if (__atomic_add_fetch(&batch_pool_count, 1, __ATOMIC_RELAXED) > k_BATCH_POOL_MAX)
+        {
+            __atomic_sub_fetch(&batch_pool_count, 1, __ATOMIC_RELAXED);
+            delete batch;
+            return;
+        }
+        HazardRetireBatch<T>* desired = batch;
+        batch->next = __atomic_load_n(&batch_pool, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange(&batch_pool, &batch->next, &desired,
+                    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+        }
+    }
+
+    /// Thread safe push of a batch of retired objects.
+    /// \returns the number of objects awaiting deletion.
+    size_t EnqueueBatchForCollection(HazardRetireBatch<T>* batch)
+    {
+        // The batch may be collected as soon as it is published, so it is
+        // counted first, a collector must not subtract it before it is
+        // added.
+        __atomic_add_fetch(&retired_bytes, batch->bytes, __ATOMIC_RELAXED);
+        HAZARD_STAT_ADD(objects_retired, batch->count);
+        size_t retired = __atomic_add_fetch(&retired_count, batch->count, __ATOMIC_RELAXED);
+        HazardRetireBatch<T>* desired = batch;
+        batch->next = __atomic_load_n(&retire_batches, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange(&retire_batches, &batch->next, &desired,
+                    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+        }
+        return retired;
+    }
+
+    /// Hand the batch of the calling thread to the collector, and collect
+    /// if the threshold has been reached. Without a collector thread
+    /// the calling thread collects.
+    /// In inline collection mode, the calling thread first scans its
+    /// own batch, and only the objects still protected are handed over.
+    void FlushBatch(HazardPointerNodeCache<T>& cache)
+    {
+        HazardRetireBatch<T>* batch = cache.retired;
+        cache.retired = NULL;
+        if (__atomic_load_n(&inline_threshold, __ATOMIC_RELAXED))
+        {
+            __atomic_add_fetch(&retired_bytes, batch->bytes, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&retired_count, batch->count, __ATOMIC_RELAXED);
+            HAZARD_STAT_ADD(objects_retired, batch->count);
+            batch->next = NULL;
+            CollectBatches(batch, std::chrono::steady_clock::now());
+            if (!HaveDeletes())
+                return;
+        }
+        else if (EnqueueBatchForCollection(batch) < ScanThreshold())
+            return;
+        if (collector_thread)
+            collector_thread->Signal(*this);
+        else
+            Collect();
+    }
+
+    /// Add an object to the batch of the calling thread.
+    void AddRetired(T* obj, void (*reclaim)(T*), const HazardRefCounted* counted,
+            size_t bytes)
+    {
+        HazardPointerNodeCache<T>& cache = ThreadCache();
+        if (cache.retired == NULL)
+            cache.retired = AcquireBatch();
+        HazardRetireBatch<T>* batch = cache.retired;
+        batch->entries[batch->count].object = obj;
+        batch->entries[batch->count].reclaim = reclaim;
+        batch->entries[batch->count].counted = counted;
+        batch->entries[batch->count].bytes = bytes;
+        batch->bytes += bytes;
+        if (++batch->count >= BatchLimit())
+            FlushBatch(cache);
+    }
+
+    /// Retire an object deleted through a hazard pointer, which cannot
+    /// fail, so HazardGarbagePolicy::k_FAIL is treated as k_HELP.
+    void RetireDeleted(T* obj)
+    {
+        RetireDeleted(obj, &DeleteObject, HazardCounted(obj), HazardObjectBytes<T>::value);
+    }
+
+    /// Retire an object with reclaim, where the caller cannot fail,
+    /// as hazard_pointer_obj_base::retire.
+    void RetireDeleted(T* obj, void (*reclaim)(T*), const HazardRefCounted* counted,
+            size_t bytes)
+    {
+        LimitGarbage(false, 1, bytes);
+        AddRetired(obj, reclaim, counted, bytes);
+    }
+
+    /// \returns the number of objects in a thread's batch at which the
+    /// batch is flushed.
+    inline unsigned BatchLimit() const
+    {
+        unsigned limit = __atomic_load_n(&inline_threshold, __ATOMIC_RELAXED);
+        return (limit && limit < HazardRetireBatch<T>::k_CAPACITY) ?
+            limit : HazardRetireBatch<T>::k_CAPACITY;
+    }
+
+    /// \returns true if retiring count objects of the given bytes would
+    /// exceed the garbage limit. Objects are accepted regardless when
+    /// none are awaiting deletion, so a bulk retire larger than the
+    /// limit does not wait forever.
+    inline bool OverGarbageLimit(size_t count, size_t bytes) const
+    {
+        size_t objects_limit = __atomic_load_n(&garbage_objects_limit, __ATOMIC_RELAXED);
+        size_t bytes_limit = __atomic_load_n(&garbage_bytes_limit, __ATOMIC_RELAXED);
+        size_t pending = RetiredCount();
+        size_t pending_bytes = RetiredBytes();
+        return (objects_limit && pending && pending + count > objects_limit)
+            || (bytes_limit && pending_bytes && pending_bytes + bytes > bytes_limit);
+    }
+
+    /// Apply the garbage policy, when retiring the objects would exceed
+    /// the garbage limit.
+    /// A collection scans every hazard pointer, so a thread helps at most
+    /// once per batch of objects it retires at the limit, rather than for
+    /// each object.
+    /// Reclamation depends on hazard pointers being cleared, which is not
+    /// notified, so a blocked thread polls, collecting with an increasing
+    /// interval.
+    /// \param may_fail false if the caller cannot fail, k_FAIL is then
+    /// treated as k_HELP.
+    /// \param count the number of objects to retire.
+    /// \param bytes the bytes accounted for the objects.
+    /// \returns false if the objects must not be retired.
+    bool LimitGarbage(bool may_fail, size_t count, size_t bytes)
+    {
+        if (!OverGarbageLimit(count, bytes))
+            return true;
+        // Collect runs reclaim functions, which may retire to other
+        // instances and so reassign the thread cache, it is looked up again.
+        if (ThreadCache().help_credit == 0)
+        {
+            Collect(true);
+            ThreadCache().help_credit = BatchLimit();
+            if (!OverGarbageLimit(count, bytes))
+                return true;
+        }
+        HazardPointerNodeCache<T>& cache = ThreadCache();
+        cache.help_credit -= std::min(cache.help_credit, count);
+        HazardGarbagePolicy policy = __atomic_load_n(&garbage_policy, __ATOMIC_RELAXED);
+        if (policy == HazardGarbagePolicy::k_HELP)
+            return true;
+        if (policy == HazardGarbagePolicy::k_FAIL)
+            return !may_fail;
+        __atomic_add_fetch(&garbage_waiters, 1, __ATOMIC_SEQ_CST);
+        for (unsigned wait_us = 1; OverGarbageLimit(count, bytes);
+                wait_us = std::min(2 * wait_us, 1000u))
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+            Collect(true);
+        }
+        __atomic_sub_fetch(&garbage_waiters, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    /// The number of retired objects at which a scan is performed.
+    inline size_t ScanThreshold() const
+    {
+        // Slabs allocate records ahead of use, free records protect nothing.
+        size_t count = __atomic_load_n(&node_count, __ATOMIC_RELAXED);
+        size_t free = __atomic_load_n(&free_nodes, __ATOMIC_RELAXED);
+        size_t threshold = __atomic_load_n(&scan_factor, __ATOMIC_RELAXED) *
+            (count > free ? count - free : 0);
+        return std::max(threshold, __atomic_load_n(&scan_minimum, __ATOMIC_RELAXED));
+    }
+
+    /// Scan the hazard pointers, delete the objects of the detached chain
+    /// of batches which are not protected, and hand the batches with
+    /// objects still protected back to the HazardPointerList.
+    /// \param batch the chain of batches, private to the calling thread.
+    /// \param start the start time of the collection.
+    void CollectBatches(HazardRetireBatch<T>* batch,
+            std::chrono::steady_clock::time_point start)
+    {
+        // The scratch buffers are retained across scans, a collector
+        // finding them in use allocates its own rather than waiting.
+        std::unique_lock<std::mutex> scratch_lockg(scratch_lock, std::try_to_lock);
+        std::vector<uintptr_t> local_ptrs;
+        HazardPointerSet<T> local_hazards;
+        std::vector<uintptr_t>& ptrs = scratch_lockg.owns_lock() ? hazard_ptrs : local_ptrs;
+        HazardPointerSet<T>& set = scratch_lockg.owns_lock() ? hazards : local_hazards;
+
+        // Slabs unlinked by Shrink are not deleted whilst scans are active.
+        __atomic_add_fetch(&active_scans, 1, __ATOMIC_SEQ_CST);
+        // Pairs with the fence in HazardPointerNode::TryProtect, objects
+        // retired before this point are either seen as protected, or
+        // are not reachable by the protecting thread.
+        HazardFence::Heavy();
+        // The pointers of each slab are read as an array with a stride
+        // of one cache line.
+        size_t nodes_scanned = 0;
+        ptrs.clear();
+        for (HazardPointerSlab<T>* slab = __atomic_load_n(&slabs, __ATOMIC_ACQUIRE);
+                slab; slab = __atomic_load_n(&slab->next, __ATOMIC_ACQUIRE))
+        {
+            HazardPointerNode<T>* node = slab->Nodes();
+            unsigned count = slab->count;
+            for (unsigned ix = 0; ix < count; ++ix)
+            {
+                T* ptr = __atomic_load_n(&node[ix].pointer, __ATOMIC_ACQUIRE);
+                if (ptr)
+                    ptrs.push_back(reinterpret_cast<uintptr_t>(ptr));
+            }
+            nodes_scanned += count;
+        }
+        __atomic_sub_fetch(&active_scans, 1, __ATOMIC_RELEASE);
+        // Few protected pointers are matched by a vectorised comparison,
+        // otherwise by hash set lookup.
+        bool linear = ptrs.size() <= HazardMatch::k_LINEAR_MAX;
+        if (!linear)
+        {
+            set.Clear(ptrs.size());
+            for (uintptr_t ptr : ptrs)
+                set.Insert(reinterpret_cast<T*>(ptr));
+        }
+
+        size_t retired_scanned = 0;
+        size_t reclaimed = 0;
+        size_t reclaimed_bytes = 0;
+#if     defined(HAZARD_POINTER_STATS)
+        uint64_t now_ns = HazardNowNs();
+#endif
+        // Batches are compacted in place, and those with objects still
+        // protected are pushed back as a single pre-linked chain.
+        HazardRetireBatch<T>* keep_first = NULL;
+        HazardRetireBatch<T>* keep_last = NULL;
+        while (batch)
+        {
+            HazardRetireBatch<T>* next_batch = batch->next;
+            unsigned kept = 0;
+            size_t kept_bytes = 0;
+            for (unsigned ix = 0; ix < batch->count; ++ix)
+            {
+                typename HazardRetireBatch<T>::Entry& entry = batch->entries[ix];
+                // A count read after the scan includes any promotion of a
+                // hazard pointer the scan found cleared.
+                if ((linear ? HazardMatch::Contains(ptrs.data(),
+                            ptrs.size(), reinterpret_cast<uintptr_t>(entry.object))
+                        : set.Contains(entry.object))
+                        || (entry.counted && entry.counted->RefCount() != 0))
+                {
+                    kept_bytes += entry.bytes;
+                    batch->entries[kept++] = entry;
+                }
+                else
+                    entry.reclaim(entry.object);
+            }
+            reclaimed_bytes += batch->bytes - kept_bytes;
+            batch->bytes = kept_bytes;
+            retired_scanned += batch->count;
+            reclaimed += batch->count - kept;
+#if     defined(HAZARD_POINTER_STATS)
+            if (batch->count != kept)
+            {
+                unsigned bucket = HazardLatencyHistogram::Bucket(
+                        (now_ns - batch->retired_ns) / 1000);
+                HAZARD_STAT_ADD(latency.buckets[bucket], batch->count - kept);
+            }
+#endif
+            batch->count = kept;
+            if (kept == 0)
+                ReleaseBatch(batch);
+            else
+            {
+                batch->next = keep_first;
+                keep_first = batch;
+                if (keep_last == NULL)
+                    keep_last = batch;
+            }
+            batch = next_batch;
+        }
+        if (keep_first)
+        {
+            HazardRetireBatch<T>* desired = keep_first;
+            keep_last->next = __atomic_load_n(&retire_batches, __ATOMIC_RELAXED);
+            while (!__atomic_compare_exchange(&retire_batches, &keep_last->next,
+                        &desired, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            {
+            }
+        }
+        __atomic_sub_fetch(&retired_count, reclaimed, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&retired_bytes, reclaimed_bytes, __ATOMIC_RELAXED);
+        if (scratch_lockg.owns_lock())
+            scratch_lockg.unlock();
+
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        __atomic_add_fetch(&scan_stats.scans, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&scan_stats.nodes_scanned, nodes_scanned, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&scan_stats.retired_scanned, retired_scanned, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&scan_stats.reclaimed, reclaimed, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&scan_stats.scan_ns, ns, __ATOMIC_RELAXED);
+        __atomic_store_n(&scan_stats.last_scan_ns, ns, __ATOMIC_RELAXED);
+    }
+
+    /// Shrink with shrink_lock held.
+    size_t ShrinkLocked()
+    {
+        size_t nreclaim = 0;
+        {
+            std::lock_guard<std::mutex> free_lockg(free_list_lock);
+            HazardPointerSlab<T>* head = __atomic_load_n(&slabs, __ATOMIC_ACQUIRE);
+            for (HazardPointerSlab<T>* slab = head; slab; slab = slab->next)
+            {
+                slab->free_count = 0;
+                slab->idle_count = 0;
+            }
+            // Only this thread removes nodes from the free list, so every
+            // node counted stays on the free list until the lock is released.
+            HazardPointerNode<T>* node = __atomic_load_n(&free_list, __ATOMIC_ACQUIRE);
+            for (; node != end_node; node = node->next)
+            {
+                ++node->slab->free_count;
+                if (node->idle)
+                    ++node->slab->idle_count;
+                else
+                    node->idle = true;
+            }
+
+            size_t count = __atomic_load_n(&node_count, __ATOMIC_RELAXED);
+            size_t retain = __atomic_load_n(&node_retain, __ATOMIC_RELAXED);
+            size_t limit = __atomic_load_n(&node_limit, __ATOMIC_RELAXED);
+            for (HazardPointerSlab<T>* slab = head; slab; slab = slab->next)
+            {
+                if (slab->free_count == slab->count && count >= retain + slab->count
+                        && (slab->idle_count == slab->count || (limit && count > limit)))
+                {
+                    slab->reclaim = true;
+                    count -= slab->count;
+                    nreclaim += slab->count;
+                }
+            }
+            if (nreclaim == 0)
+            {
+                DeleteUnlinkedSlabs();
+                return 0;
+            }
+
+            HazardPointerNode<T>* prev = NULL;
+            node = __atomic_load_n(&free_list, __ATOMIC_ACQUIRE);
+            while (node != end_node)
+            {
+                HazardPointerNode<T>* next = node->next;
+                if (node->slab->reclaim)
+                    prev = unlink(&free_list, prev, node);
+                else
+                    prev = node;
+                node = next;
+            }
+            __atomic_sub_fetch(&free_nodes, nreclaim, __ATOMIC_RELAXED);
+        }
+
+        // Unlink from the set of all slabs, only NewSlab modifies the set
+        // concurrently, by pushing at the head.
+        HazardPointerSlab<T>* prev = NULL;
+        HazardPointerSlab<T>* slab = __atomic_load_n(&slabs, __ATOMIC_ACQUIRE);
+        while (slab)
+        {
+            HazardPointerSlab<T>* next = slab->next;
+            if (slab->reclaim)
+            {
+                HazardPointerSlab<T>* expected = slab;
+                if (prev == NULL && !__atomic_compare_exchange(&slabs,
+                            &expected, &next, false,
+                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                {
+                    prev = expected;
+                    while (prev->next != slab)
+                        prev = prev->next;
+                }
+                if (prev)
+                    __atomic_store_n(&prev->next, next, __ATOMIC_RELEASE);
+                slab->unlinked = unlinked_slabs;
+                unlinked_slabs = slab;
+            }
+            else
+                prev = slab;
+            slab = next;
+        }
+        __atomic_sub_fetch(&node_count, nreclaim, __ATOMIC_RELAXED);
+        node_available.fence_and_notify();
+        DeleteUnlinkedSlabs();
+        return nreclaim;
+    }
+
+    /// Delete unlinked slabs, if no scan is active. A scan starting after
+    /// this check cannot reach the slabs.
+    void DeleteUnlinkedSlabs()
+    {
+        if (unlinked_slabs == NULL)
+            return;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&active_scans, __ATOMIC_SEQ_CST))
+            return;
+        while (unlinked_slabs)
+        {
+            HazardPointerSlab<T>* slab = unlinked_slabs;
+            unlinked_slabs = slab->unlinked;
+            DeleteSlab(slab);
+        }
+    }
+
+    void init()
+    {
+        HazardFence::Register();
+        end_node = new(HazardSlabMemory::Allocate(sizeof(HazardPointerNode<T>)))
+            HazardPointerNode<T>(this);
+        end_node->next = end_node;
+        free_list = end_node;
+    }
+
+ public:
+    HazardPointerList()
+    {
+        init();
+        domain_id = HazardDomainRegistry::Register();
+    }
+
+    explicit HazardPointerList(CollectorThread* th_collector)
+    {
+        init();
+        domain_id = HazardDomainRegistry::Register();
+        th_collector->RegisterClient(*this);
+    }
+
+    /// HazardPointerList destructor is non trivial and NOT thread safe.
+    /// Clients MUST ensure that the HazardPointerList is NOT being accessed
+    /// by other threads.
+    /// To prevent leaks all retired objects are deleted.
+    /// Release is invoked on all nodes not in the free list,
+    /// and the nodes are deleted.
+    /// This will leave associated HazardPointer instances with dangling
+    /// pointers. One fix would be to maintain a list of all associated
+    /// HazardPointer instances, and invalidate them here.
+    /// That would be complex and expensive.
+    /// For now program structure and sequencing must work around this 
+    /// limitation.
+    /// Objects retired by the calling thread are collected, objects in the
+    /// partially filled batches of other threads are deleted on exit
+    /// of those threads.
+    ~HazardPointerList()
+    {
+        if (collector_thread)
+            collector_thread->DeregisterClient(*this);
+        FlushRetired();
+        // After this, nodes in thread caches are no longer returned
+        // to this instance.
+        HazardDomainRegistry::Deregister(domain_id);
+
+        for (HazardPointerSlab<T>* slab = slabs; slab; slab = slab->next)
+        {
+            HazardPointerNode<T>* node = slab->Nodes();
+            for (unsigned ix = 0; ix < slab->count; ++ix)
+            {
+                if (node[ix].pointer)
+                    __atomic_store_n(&node[ix].pointer, 0x0, __ATOMIC_RELEASE);
+            }
+        }
+
+        Collect(true);
+        CHECK_ASSERT(retire_batches == NULL);
+        while (batch_pool)
+        {
+            HazardRetireBatch<T>* batch = batch_pool;
+            batch_pool = batch->next;
+            delete batch;
+        }
+        free_list = end_node;
+        while (slabs)
+        {
+            HazardPointerSlab<T>* slab = slabs;
+            slabs = slab->next;
+            DeleteSlab(slab);
+        }
+        DeleteUnlinkedSlabs();
+        end_node->~HazardPointerNode<T>();
+        HazardSlabMemory::Free(end_node, sizeof(HazardPointerNode<T>));
+    }
+
+    /// Add nodes to the free list.
+    /// One strategy to avoid blocking on HazardPointerNode acquisition
+    /// is to "prime" the free list by adding nodes to it.
+    /// Working out an optimal value for an application requires
+    ///  1) foreknowledge of the (maximum) number of threads 
+    ///  2) foreknowledge of the number of Hazard Pointers used by each thread.
+    ///  3) a guaranteed object collection rate.
+    /// The 3rd is non trivial to arrange, especially when collection occurs asynchronously
+    /// in another thread.
+    /// An alternatively is to use a non-blocking allocator.
+    /// Primed nodes are retained by Shrink.
+    void Prime(size_t node_count)
+    {
+        size_t count = __atomic_add_fetch(&this->node_count, node_count,
+                __ATOMIC_RELAXED);
+        size_t retain = __atomic_load_n(&node_retain, __ATOMIC_RELAXED);
+        while (retain < count && !__atomic_compare_exchange_n(&node_retain,
+                    &retain, count, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+        }
+        while (node_count)
+        {
+            unsigned slab_count = (unsigned)std::min<size_t>(node_count,
+                    HazardPointerSlab<T>::k_NODES);
+            HazardPointerNode<T>* node = NewSlab(slab_count)->Nodes();
+            __atomic_add_fetch(&free_nodes, slab_count, __ATOMIC_RELAXED);
+            push_chain(&node[0], &node[slab_count - 1], &free_list);
+            node_count -= slab_count;
+        }
+        node_available.fence_and_notify();
+    }
+
+    /// Acquire a hazard pointer record.
+    /// The "new" record may be a "recycled" instance or created anew which may 
+    /// block on memory allocation.
+    /// Recycled instances are taken from the thread cache, which is refilled
+    /// from the free list in batches.
+    /// If the node limit has been reached, the node policy applies,
+    /// NULL is returned for HazardNodePolicy::k_FAIL.
+    HazardPointerNode<T>*  AcquireNode()
+    {
+        HazardPointerNodeCache<T>& cache = ThreadCache();
+        if (cache.head != NULL || RefillCache(cache))
+            return PopCache(cache);
+        return NewNode(cache);
+    }
+
+    /// Acquire hazard pointer records, with a single thread cache lookup.
+    /// \param nodes receives the records.
+    /// \param count the number of records.
+    /// \returns false if the node limit was reached with
+    /// HazardNodePolicy::k_FAIL, no records are acquired.
+    bool AcquireNodes(HazardPointerNode<T>** nodes, unsigned count)
+    {
+        HazardPointerNodeCache<T>& cache = ThreadCache();
+        for (unsigned ix = 0; ix < count; ++ix)
+        {
+            if (cache.head != NULL || RefillCache(cache))
+                nodes[ix] = PopCache(cache);
+            else if (NULL == (nodes[ix] = NewNode(cache)))
+            {
+                EnqueueFreeRecords(nodes, ix);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Garbage collector function, objects which have been scheduled for
+    /// deletion, are safely deleted by this function.
+    /// The function is thread safe and does not block, any thread may
+    /// help collect. Concurrent collectors process disjoint sets of
+    /// retired objects.
+    /// The hazard pointer records are only scanned if the number of
+    /// retired objects has reached the scan threshold.
+    /// Returns false if the retired objects remaining after the scan
+    /// still exceed the threshold, true otherwise.
+    bool Collect()
+    {
+        return Collect(false);
+    }
+
+    /// Garbage collector function.
+    /// \param force if true scan regardless of the scan threshold.
+    bool Collect(bool force)
+    {
+        if (RetiredCount() == 0)
+            return true;
+        if (!force && !HaveDeletes())
+            return true;
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        // All batches are detached in a single exchange, and are private
+        // to this thread. Concurrent collectors find no batches, or
+        // batches retired after the exchange.
+        // Detaching before the fence is required, objects retired after
+        // the hazard pointers have been read may be protected by them.
+        HazardRetireBatch<T>* batch =
+            __atomic_exchange_n(&retire_batches, NULL, __ATOMIC_ACQ_REL);
+        if (batch == NULL)
+            return !HaveDeletes();
+
+        CollectBatches(batch, start);
+        TryShrink();
+        return !HaveDeletes();
+    }
+
+    /// Delete idle slabs, slabs with all nodes on the free list since
+    /// the previous call, and free slabs in excess of the node limit.
+    /// Nodes cached by threads are not on the free list, so keep their
+    /// slabs alive.
+    /// At least node_retain nodes are retained.
+    /// Slabs are deleted once no scan is active, until then they are
+    /// held on a list of unlinked slabs.
+    /// \returns the number of nodes deleted.
+    size_t Shrink()
+    {
+        std::lock_guard<std::mutex> lockg(shrink_lock);
+        return ShrinkLocked();
+    }
+
+    /// Shrink, unless another thread is shrinking. Invoked by Collect.
+    size_t TryShrink()
+    {
+        std::unique_lock<std::mutex> lockg(shrink_lock, std::try_to_lock);
+        if (!lockg.owns_lock())
+            return 0;
+        return ShrinkLocked();
     }
 
+    /// Set the limits on the number of hazard pointer records.
+    /// With HazardNodePolicy::k_BLOCK, nodes cached by threads which are
+    /// not releasing HazardPointers are unavailable to waiting threads.
+    /// \param retain the number of nodes retained by Shrink.
+    /// \param limit maximum number of nodes, 0 for no limit.
+    /// \param policy behaviour of AcquireNode when the limit is reached.
+    void SetNodeLimits(size_t retain, size_t limit, HazardNodePolicy policy)
+    {
+        __atomic_store_n(&node_retain, retain, __ATOMIC_RELAXED);
+        __atomic_store_n(&node_limit, limit, __ATOMIC_RELAXED);
+        __atomic_store_n(&node_policy, policy, __ATOMIC_RELAXED);
+        node_available.fence_and_notify();
+    }
+
+    /// \returns the number of threads waiting for a node, with
+    /// HazardNodePolicy::k_BLOCK.
+    unsigned NodeWaiters() const
+    {
+        return __atomic_load_n(&node_waiters, __ATOMIC_SEQ_CST);
+    }
+
+    /// \returns the number of threads waiting in Retire for the retired
+    /// objects to be within the garbage limit, with
+    /// HazardGarbagePolicy::k_BLOCK.
+    unsigned GarbageWaiters() const
+    {
+        return __atomic_load_n(&garbage_waiters, __ATOMIC_SEQ_CST);
+    }
+
+    /// \returns the number of hazard pointer records.
+    size_t NodeCount() const
+    {
+        return __atomic_load_n(&node_count, __ATOMIC_RELAXED);
+    }
+
+    /// Retire an object, which is deleted once no hazard pointer protects
+    /// it. The object must no longer be reachable by other threads.
+    /// Objects are added to a batch private to the calling thread,
+    /// full batches are handed to the collector.
+    /// \returns false if the object was not retired, because the garbage
+    /// limit was reached, with HazardGarbagePolicy::k_FAIL.
+    bool Retire(T* obj)
+    {
+        return Retire(&obj, 1);
+    }
+
+    /// Retire an object, which is deleted by reclaim.
+    /// \param obj the object to retire.
+    /// \param reclaim the function invoked to delete the object.
+    bool Retire(T* obj, void (*reclaim)(T*))
+    {
+        return Retire(&obj, 1, reclaim);
+    }
+
+    /// Retire an object, whose counted base and size are only known to
+    /// the caller, the object is deleted once no hazard pointer protects
+    /// it and the count is zero.
+    /// \param obj the object to retire.
+    /// \param reclaim the function invoked to delete the object.
+    /// \param counted the counted base of the object, may be NULL.
+    /// \param bytes the bytes accounted for the object.
+    bool Retire(T* obj, void (*reclaim)(T*), const HazardRefCounted* counted,
+            size_t bytes = HazardObjectBytes<T>::value)
+    {
+        if (!LimitGarbage(true, 1, bytes))
+            return false;
+        AddRetired(obj, reclaim, counted, bytes);
+        return true;
+    }
+
+    /// Retire objects in bulk.
+    /// \param objs the objects to retire.
+    /// \param count the number of objects.
+    /// \param reclaim the function invoked to delete each object.
+    /// \returns false if no object was retired, because the garbage limit
+    /// was reached, with HazardGarbagePolicy::k_FAIL.
+    bool Retire(T* const* objs, size_t count, void (*reclaim)(T*) = &DeleteObject)
+    {
+        if (!LimitGarbage(true, count, count * HazardObjectBytes<T>::value))
+            return false;
+        unsigned limit = BatchLimit();
+        while (count)
+        {
+            // FlushBatch may collect, running reclaim functions which may
+            // retire to other instances and so reassign the thread cache,
+            // it is looked up for each batch.
+            HazardPointerNodeCache<T>& cache = ThreadCache();
+            if (cache.retired == NULL)
+                cache.retired = AcquireBatch();
+            HazardRetireBatch<T>* batch = cache.retired;
+            while (count && batch->count < limit)
+            {
+                batch->entries[batch->count].object = *objs;
+                batch->entries[batch->count].reclaim = reclaim;
+                batch->entries[batch->count].counted = HazardCounted(*objs++);
+                batch->entries[batch->count].bytes = HazardObjectBytes<T>::value;
+                batch->bytes += HazardObjectBytes<T>::value;
+                ++batch->count;
+                --count;
+            }
+            if (batch->count >= limit)
+                FlushBatch(cache);
+        }
+        return true;
+    }
+
+    /// Hand the objects retired by the calling thread to the collector,
+    /// without waiting for its batch to fill.
+    void FlushRetired()
+    {
+        HazardPointerNodeCache<T>& cache = ThreadCache();
+        if (cache.retired)
+            FlushBatch(cache);
+    }
+
+    /// Set the scan threshold, Collect scans for hazard pointers when
+    /// the number of retired objects reaches
+    /// max(factor * number of hazard pointer records, minimum),
+    /// records on the free list are not counted.
+    /// Larger values reduce the scan cost per reclaimed object,
+    /// at the expense of more memory held by retired objects.
+    void SetScanThreshold(size_t factor, size_t minimum)
+    {
+        __atomic_store_n(&scan_factor, factor, __ATOMIC_RELAXED);
+        __atomic_store_n(&scan_minimum, minimum, __ATOMIC_RELAXED);
+    }
+
+    /// Set the limits on the objects awaiting deletion, objects in the
+    /// batches of threads are not counted, at most one batch per thread.
+    /// With HazardGarbagePolicy::k_BLOCK, a thread protecting objects
+    /// retired to this instance must not retire to it.
+    /// \param objects maximum number of objects, 0 for no limit.
+    /// \param bytes maximum number of bytes, 0 for no limit.
+    /// \param policy behaviour of Retire when the limit is reached.
+    void SetGarbageLimits(size_t objects, size_t bytes, HazardGarbagePolicy policy)
+    {
+        __atomic_store_n(&garbage_objects_limit, objects, __ATOMIC_RELAXED);
+        __atomic_store_n(&garbage_bytes_limit, bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&garbage_policy, policy, __ATOMIC_RELAXED);
+    }
+
+    /// Set inline collection, a thread flushes its batch once it holds
+    /// threshold objects, and scans the hazard pointers for those objects
+    /// itself, before handing over those still protected. The cost of
+    /// the scan is bounded by the number of hazard pointers and the
+    /// threshold, and reclamation does not depend on a collector thread.
+    /// \param threshold the number of objects, 0 to disable.
+    void SetInlineCollect(unsigned threshold)
+    {
+        __atomic_store_n(&inline_threshold, threshold, __ATOMIC_RELAXED);
+    }
+
+    /// \returns the cumulative scan costs, the fields are read
+    /// individually, and may be mutually inconsistent whilst collecting.
+    HazardScanStats ScanStats() const
+    {
+        HazardScanStats stats;
+        stats.scans = __atomic_load_n(&scan_stats.scans, __ATOMIC_RELAXED);
+        stats.nodes_scanned = __atomic_load_n(&scan_stats.nodes_scanned, __ATOMIC_RELAXED);
+        stats.retired_scanned = __atomic_load_n(&scan_stats.retired_scanned, __ATOMIC_RELAXED);
+        stats.reclaimed = __atomic_load_n(&scan_stats.reclaimed, __ATOMIC_RELAXED);
+        stats.scan_ns = __atomic_load_n(&scan_stats.scan_ns, __ATOMIC_RELAXED);
+        stats.last_scan_ns = __atomic_load_n(&scan_stats.last_scan_ns, __ATOMIC_RELAXED);
+        return stats;
+    }
+
+    /// \returns a snapshot of the gauges and counters, the fields are read
+    /// individually, and may be mutually inconsistent whilst retiring
+    /// and collecting.
+    HazardDomainStats Snapshot() const
+    {
+        HazardDomainStats stats;
+        stats.nodes = NodeCount();
+        stats.free_nodes = __atomic_load_n(&free_nodes, __ATOMIC_RELAXED);
+        stats.retired = RetiredCount();
+        stats.retired_bytes = RetiredBytes();
+        stats.scans = ScanStats();
+        stats.objects_retired = __atomic_load_n(&objects_retired, __ATOMIC_RELAXED);
+        for (unsigned ix = 0; ix < HazardLatencyHistogram::k_BUCKETS; ++ix)
+            stats.latency.buckets[ix] = __atomic_load_n(&latency.buckets[ix], __ATOMIC_RELAXED);
+        return stats;
+    }
+
+    /// \returns the number of objects awaiting deletion.
+    size_t RetiredCount() const
+    {
+        return __atomic_load_n(&retired_count, __ATOMIC_RELAXED);
+    }
+
+    /// \returns the bytes accounted for the objects awaiting deletion.
+    size_t RetiredBytes() const
+    {
+        return __atomic_load_n(&retired_bytes, __ATOMIC_RELAXED);
+    }
+
+    /// \returns true if the number of retired objects has reached the
+    /// scan threshold.
     inline bool HaveDeletes()
     {
-        return gc_list != end_node;
+        size_t retired = RetiredCount();
+        return retired != 0 && retired >= ScanThreshold();
     }
 };
 
@@ -589,10 +2380,9 @@ template <typename T> class HazardPointer {
     /// Somewhat movable, to facilitate declaration of arrays of HazardPointer.
     /// To support these semantics correctly we must now, check that the associated
     /// HazardPointerNode is non-null before using it, a loss in efficiency :-(.
-    HazardPointer(HazardPointer&& other)
+    HazardPointer(HazardPointer&& other):hp_node(other.hp_node)
     {
-        other.hp_node = std::move(hp_node);
-        hp_node = NULL;
+        other.hp_node = NULL;
     }
     HazardPointer& operator=(const HazardPointer&&) = delete;
 
@@ -650,6 +2440,42 @@ template <typename T> class HazardPointer {
         return true;
     }
 
+    /// \returns true if the instance is bound to a HazardPointerNode,
+    /// false if the node limit was reached with HazardNodePolicy::k_FAIL,
+    /// or after Release or Delete.
+    inline bool IsBound() const
+    {
+        return NULL != hp_node;
+    }
+
+    /// Protects the object src points to, retrying until src is confirmed
+    /// to still point to the object after the pointer was published.
+    /// \param src the location of the object pointer.
+    /// \returns the protected object pointer, NULL if the instance is
+    /// not bound to a HazardPointerNode.
+    inline T* protect(const std::atomic<T*>& src)
+    {
+        if (NULL == hp_node)
+            return NULL;
+        T* ptr = src.load(std::memory_order_relaxed);
+        while (!hp_node->TryProtect(ptr, src))
+        {
+        }
+        return ptr;
+    }
+
+    /// Attempts to protect ptr, a value previously loaded from src.
+    /// \param ptr the object pointer, updated with the current value
+    /// of src on failure.
+    /// \param src the location of the object pointer.
+    /// \returns true if the object is protected, false otherwise.
+    inline bool try_protect(T*& ptr, const std::atomic<T*>& src)
+    {
+        if (NULL == hp_node)
+            return false;
+        return hp_node->TryProtect(ptr, src);
+    }
+
     /// Removes the object pointer from the list of hazard pointers,
     /// the object pointed to by the pointer, may now be subject
     /// to collection and is no longer accessible using this
@@ -666,8 +2492,8 @@ template <typename T> class HazardPointer {
     /// and is not accessible using this instance.
     inline void Delete()
     {
-        if (NULL != hp_node)
-            hp_node->Delete();
+        if (NULL != hp_node && !hp_node->Delete())
+            hp_node->Release();
         hp_node = NULL;
     }
 
@@ -680,8 +2506,317 @@ template <typename T> class HazardPointer {
             return hp_node->get_pointer();
         return NULL;
     }
+
+    /// Converts the protection to a counted reference, T must be derived
+    /// from HazardRefCounted. The count is taken before the object pointer
+    /// is cleared, so there is no window in which the object may be
+    /// deleted. The hazard pointer remains bound and may be reused.
+    /// \returns the reference, empty if no object is protected.
+    inline HazardRef<T> promote()
+    {
+        T* ptr = (*this)();
+        if (NULL == ptr)
+            return HazardRef<T>();
+        HazardRef<T> ref(ptr);
+        hp_node->Clear();
+        return ref;
+    }
+};
+
+/**
+ * \class HazardPointerArray
+ *
+ * A fixed number of hazard pointers, acquired and released together,
+ * for traversals which protect several objects at once, for example
+ * hand-over-hand traversal of a linked list.
+ * The slots are bound on construction, and remain bound until destruction,
+ * so slot operations do not check for an unbound slot.
+ * swap exchanges the roles of two slots, without republishing pointers.
+ * \tparam K the number of slots.
+ */
+template <typename T, unsigned K> class HazardPointerArray {
+    static_assert(K > 0, "HazardPointerArray requires at least one slot");
+
+    /// Node pointers of the slots, on a single cache line for up to 8 slots.
+    alignas(64) HazardPointerNode<T>*  hp_nodes[K];
+    bool bound;
+
+ public:
+    static void *operator new(size_t) = delete;
+    static void *operator new[](size_t) = delete;
+    static void operator delete(void *) = delete;
+    static void operator delete[](void *) = delete;
+
+    // Non copyable.
+    HazardPointerArray(const HazardPointerArray&) = delete;
+    HazardPointerArray& operator=(const HazardPointerArray&) = delete;
+    // Non movable.
+    HazardPointerArray(HazardPointerArray&&) = delete;
+    HazardPointerArray& operator=(HazardPointerArray&&) = delete;
+
+    /// Constructor, acquires K HazardPointerNode instances.
+    /// If the node limit of hplist was reached with
+    /// HazardNodePolicy::k_FAIL, the instance is unbound, and must
+    /// not be used.
+    explicit HazardPointerArray(HazardPointerList<T>& hplist)
+    {
+        bound = hplist.AcquireNodes(hp_nodes, K);
+    }
+
+    /// Destructor, clears all slots and releases the nodes.
+    ~HazardPointerArray()
+    {
+        if (bound)
+        {
+            for (unsigned ix = 0; ix < K; ++ix)
+                hp_nodes[ix]->Clear();
+            hp_nodes[0]->owner->EnqueueFreeRecords(hp_nodes, K);
+        }
+    }
+
+    /// \returns true if the slots are bound to HazardPointerNode instances.
+    inline bool IsBound() const
+    {
+        return bound;
+    }
+
+    static constexpr unsigned size()
+    {
+        return K;
+    }
+
+    /// Protects the object src points to in slot ix.
+    /// \returns the protected object pointer.
+    inline T* protect(unsigned ix, const std::atomic<T*>& src)
+    {
+        CHECK_ASSERT(bound && ix < K);
+        T* ptr = src.load(std::memory_order_relaxed);
+        while (!hp_nodes[ix]->TryProtect(ptr, src))
+        {
+        }
+        return ptr;
+    }
+
+    /// Attempts to protect ptr, a value previously loaded from src,
+    /// in slot ix.
+    /// \returns true if the object is protected, false otherwise,
+    /// ptr is updated with the current value of src.
+    inline bool try_protect(unsigned ix, T*& ptr, const std::atomic<T*>& src)
+    {
+        CHECK_ASSERT(bound && ix < K);
+        return hp_nodes[ix]->TryProtect(ptr, src);
+    }
+
+    /// Sets the object pointer of slot ix, as HazardPointer::Acquire.
+    inline void Acquire(unsigned ix, T** ptrptr)
+    {
+        CHECK_ASSERT(bound && ix < K);
+        hp_nodes[ix]->Acquire(ptrptr);
+    }
+
+    /// Clears the object pointer of slot ix.
+    inline void Clear(unsigned ix)
+    {
+        CHECK_ASSERT(bound && ix < K);
+        hp_nodes[ix]->Clear();
+    }
+
+    /// Clears slot ix, and retires the object it protected.
+    inline void Delete(unsigned ix)
+    {
+        CHECK_ASSERT(bound && ix < K);
+        T* obj = hp_nodes[ix]->get_pointer();
+        if (obj)
+        {
+            hp_nodes[ix]->owner->RetireDeleted(obj);
+            hp_nodes[ix]->Clear();
+        }
+    }
+
+    /// Exchange slots ix and jx, the objects remain protected.
+    inline void swap(unsigned ix, unsigned jx)
+    {
+        CHECK_ASSERT(bound && ix < K && jx < K);
+        std::swap(hp_nodes[ix], hp_nodes[jx]);
+    }
+
+    /// \returns the object pointer of slot ix.
+    inline T* operator[](unsigned ix) const
+    {
+        CHECK_ASSERT(bound && ix < K);
+        return hp_nodes[ix]->get_pointer();
+    }
+};
+
+/**
+ * Hazard pointer API in the style of the C++ standard proposal P2530.
+ *
+ * A single type erased domain is shared by objects of all types,
+ * retired objects are deleted by the deleter supplied on retirement,
+ * so a single scan covers all types.
+ */
+typedef HazardPointerList<void> hazard_pointer_domain;
+
+/// \returns the domain shared by all types.
+/// The default domain has no collector thread, retiring threads collect
+/// when the scan threshold is reached.
+hazard_pointer_domain& hazard_pointer_default_domain();
+
+/**
+ * \class hazard_pointer_obj_base
+ *
+ * Base class for objects protected by hazard pointers.
+ * \tparam T the derived class.
+ * \tparam D the deleter type, invoked with a T*.
+ */
+template <typename T, typename D = std::default_delete<T>>
+class hazard_pointer_obj_base {
+    D deleter;
+
+    static void reclaim(void* obj)
+    {
+        T* t = static_cast<T*>(obj);
+        D d(std::move(static_cast<hazard_pointer_obj_base*>(t)->deleter));
+        d(t);
+    }
+
+ protected:
+    hazard_pointer_obj_base() = default;
+    hazard_pointer_obj_base(const hazard_pointer_obj_base&) = default;
+    hazard_pointer_obj_base(hazard_pointer_obj_base&&) = default;
+    hazard_pointer_obj_base& operator=(const hazard_pointer_obj_base&) = default;
+    hazard_pointer_obj_base& operator=(hazard_pointer_obj_base&&) = default;
+    ~hazard_pointer_obj_base() = default;
+
+ public:
+    /// Retire the object, d is invoked on the object once it is not
+    /// protected by any hazard pointer of the domain.
+    /// The object must no longer be reachable by other threads.
+    /// retire cannot fail, HazardGarbagePolicy::k_FAIL is treated as k_HELP.
+    void retire(D d = D(),
+            hazard_pointer_domain& domain = hazard_pointer_default_domain())
+    {
+        deleter = std::move(d);
+        domain.RetireDeleted(static_cast<T*>(this), &reclaim,
+                HazardCounted(static_cast<T*>(this)), sizeof(T));
+    }
+};
+
+/**
+ * \class hazard_pointer
+ *
+ * Single hazard pointer, which can protect objects of any type,
+ * created by make_hazard_pointer.
+ * Instances are movable, a moved from or default constructed instance
+ * is empty, and must not be used for protection.
+ */
+class hazard_pointer {
+    HazardPointerNode<void>* hp_node = NULL;
+
+    explicit hazard_pointer(HazardPointerNode<void>* node):hp_node(node){}
+    friend hazard_pointer make_hazard_pointer(hazard_pointer_domain& domain);
+
+ public:
+    // Non copyable.
+    hazard_pointer(const hazard_pointer&) = delete;
+    hazard_pointer& operator=(const hazard_pointer&) = delete;
+
+    hazard_pointer(){}
+    hazard_pointer(hazard_pointer&& other):hp_node(other.hp_node)
+    {
+        other.hp_node = NULL;
+    }
+    hazard_pointer& operator=(hazard_pointer&& other)
+    {
+        if (this != &other)
+        {
+            if (hp_node)
+                hp_node->Release();
+            hp_node = other.hp_node;
+            other.hp_node = NULL;
+        }
+        return *this;
+    }
+    ~hazard_pointer()
+    {
+        if (hp_node)
+            hp_node->Release();
+    }
+
+    bool empty() const
+    {
+        return NULL == hp_node;
+    }
+
+    /// Protects the object src points to, retrying until src is confirmed
+    /// to still point to the object after the pointer was published.
+    /// \returns the protected object pointer.
+    template <typename T> T* protect(const std::atomic<T*>& src)
+    {
+        CHECK_ASSERT(!empty());
+        T* ptr = src.load(std::memory_order_relaxed);
+        while (!hp_node->TryProtect(ptr, src))
+        {
+        }
+        return ptr;
+    }
+
+    /// Attempts to protect ptr, a value previously loaded from src.
+    /// \param ptr the object pointer, updated with the current value
+    /// of src on failure.
+    /// \returns true if the object is protected, false otherwise.
+    template <typename T> bool try_protect(T*& ptr, const std::atomic<T*>& src)
+    {
+        CHECK_ASSERT(!empty());
+        return hp_node->TryProtect(ptr, src);
+    }
+
+    /// Protect ptr, without validation, the caller must ensure
+    /// the object has not been retired.
+    template <typename T> void reset_protection(const T* ptr)
+    {
+        CHECK_ASSERT(!empty());
+        hp_node->Protect(const_cast<T*>(ptr));
+    }
+
+    /// Clear protection.
+    void reset_protection(std::nullptr_t = nullptr)
+    {
+        CHECK_ASSERT(!empty());
+        hp_node->Clear();
+    }
+
+    /// Converts the protection of ptr to a counted reference, and clears
+    /// protection, T must be derived from HazardRefCounted.
+    /// \param ptr the object currently protected by this hazard pointer.
+    template <typename T> HazardRef<T> promote(T* ptr)
+    {
+        CHECK_ASSERT(!empty());
+        CHECK_ASSERT(hp_node->get_pointer() == static_cast<void*>(ptr));
+        HazardRef<T> ref(ptr);
+        hp_node->Clear();
+        return ref;
+    }
+
+    void swap(hazard_pointer& other)
+    {
+        std::swap(hp_node, other.hp_node);
+    }
 };
 
+/// \returns a hazard pointer of the domain, the hazard pointer is empty if
+/// the node limit of the domain was reached with HazardNodePolicy::k_FAIL.
+inline hazard_pointer make_hazard_pointer(
+        hazard_pointer_domain& domain = hazard_pointer_default_domain())
+{
+    return hazard_pointer(domain.AcquireNode());
+}
+
+inline void swap(hazard_pointer& a, hazard_pointer& b)
+{
+    a.swap(b);
+}
+
 } // namespace concurrent
 } // namespace benedias
 #endif  // _HAZARDPOINTER_HPP_INCLUDED
@@ -0,0 +1,74 @@
+/*
+
+Copyright (C) 2018  Blaise Dias
+
+This file is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This file is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this file.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bdasync.h"
+
+namespace benedias {
+
+void async_wait_list::push(async_waiter* waiter)
+{
+    async_waiter* desired = waiter;
+    waiter->next = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange(&head, &waiter->next, &desired,
+                false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+void async_wait_list::notify_all()
+{
+    // The list being drained by this thread, notify callbacks may release
+    // the primitive again, which would re-enter this function.
+    // Rather than recursing, the outermost call is asked to drain again.
+    static thread_local async_wait_list* draining = nullptr;
+
+    if (empty())
+        return;
+
+    if (draining == this)
+    {
+        __atomic_store_n(&redo, true, __ATOMIC_RELAXED);
+        return;
+    }
+
+    async_wait_list* saved = draining;
+    draining = this;
+    do
+    {
+        __atomic_store_n(&redo, false, __ATOMIC_RELAXED);
+        async_waiter* waiter = __atomic_exchange_n(&head, nullptr, __ATOMIC_ACQ_REL);
+        // Waiters were pushed, so reverse for FIFO order.
+        async_waiter* fifo = nullptr;
+        while (waiter)
+        {
+            async_waiter* next = waiter->next;
+            waiter->next = fifo;
+            fifo = waiter;
+            waiter = next;
+        }
+        while (fifo)
+        {
+            async_waiter* next = fifo->next;
+            fifo->notify(fifo);
+            fifo = next;
+        }
+    } while (__atomic_load_n(&redo, __ATOMIC_RELAXED));
+    draining = saved;
+}
+
+} // namespace benedias
@@ -0,0 +1,159 @@
+/*
+
+Copyright (C) 2018  Blaise Dias
+
+This file is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This file is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this file.  If not, see <http://www.gnu.org/licenses/>.
+
+Support for asynchronous (non thread blocking) waiters on the futex based
+synchronisation primitives.
+
+The waiter list itself is plain C++14, so the primitives can maintain one
+regardless of the language level of their clients.
+The coroutine awaitables built on top of it are only available when
+compiling with C++20 coroutine support.
+*/
+#ifndef BENEDIAS_ASYNC_H_INCLUDED
+#define BENEDIAS_ASYNC_H_INCLUDED
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+namespace benedias {
+
+// @brief record for a waiter which must not block the thread it runs on.
+// The record is owned by the waiter, and must remain valid until notify
+// has been invoked.
+struct async_waiter
+{
+    async_waiter* next = nullptr;
+    // @brief invoked by the thread which made the resource available,
+    // typically it attempts to acquire the resource on behalf of the waiter,
+    // and re-enqueues the waiter on failure.
+    void (*notify)(async_waiter*) = nullptr;
+};
+
+// @brief lock free list of async_waiter records.
+// Waiters are pushed atomically, and the complete list is atomically
+// detached on notification, so no node is ever unlinked individually.
+class async_wait_list
+{
+    // Non copyable
+    async_wait_list& operator=(const async_wait_list&) = delete;
+    async_wait_list(async_wait_list const&) = delete;
+
+    // Non movable
+    async_wait_list& operator=(async_wait_list&&) = delete;
+    async_wait_list(async_wait_list&&) = delete;
+
+    async_waiter* head = nullptr;
+    //@brief set when notify_all is re-entered on a thread already draining
+    //this list, the outermost call then drains the list again.
+    bool redo = false;
+
+    public:
+    async_wait_list(){}
+    //@brief atomically push a waiter, sequentially consistent so that
+    //a subsequent check of the primitive state cannot be reordered before it.
+    void push(async_waiter* waiter);
+    //@brief true if there are no waiters.
+    inline bool empty() const
+    {
+        return nullptr == __atomic_load_n(&head, __ATOMIC_SEQ_CST);
+    }
+    //@brief detaches all waiters and invokes notify on each in FIFO order.
+    void notify_all();
+};
+
+#if defined(__cpp_impl_coroutine)
+// @brief executor on which coroutines waiting on a primitive are resumed.
+class async_executor
+{
+    public:
+    virtual void execute(std::coroutine_handle<> handle) = 0;
+    virtual ~async_executor(){}
+};
+
+// @brief executor which resumes the coroutine immediately, on the thread
+// which made the resource available.
+class inline_executor: public async_executor
+{
+    public:
+    void execute(std::coroutine_handle<> handle) override
+    {
+        handle.resume();
+    }
+
+    static inline_executor& instance()
+    {
+        static inline_executor executor;
+        return executor;
+    }
+};
+
+// @brief awaitable for acquisition of a resource on a synchronisation
+// primitive.
+// await_ready is the regular non blocking acquisition, so the uncontended
+// path is unchanged. On contention the awaiter is pushed on the primitive's
+// waiter list, and is resumed on the executor once acquisition succeeded.
+// Sync must provide
+//   bool TryAcquire() : non blocking acquisition.
+//   void Enqueue(async_waiter*) : push the waiter, and ensure that it will be
+//   notified if the resource became available concurrently.
+template <typename Sync, bool (Sync::*TryAcquire)(),
+         void (Sync::*Enqueue)(async_waiter*)>
+class async_acquire_awaiter: private async_waiter
+{
+    Sync& sync;
+    async_executor& executor;
+    std::coroutine_handle<> handle;
+
+    static void on_notify(async_waiter* waiter)
+    {
+        async_acquire_awaiter* self = static_cast<async_acquire_awaiter*>(waiter);
+        self->next = nullptr;
+        if ((self->sync.*TryAcquire)())
+        {
+            // self may be destroyed once the coroutine is resumed.
+            self->executor.execute(self->handle);
+        }
+        else
+        {
+            (self->sync.*Enqueue)(self);
+        }
+    }
+
+    public:
+    async_acquire_awaiter(Sync& s, async_executor& ex):sync(s),executor(ex)
+    {
+        notify = on_notify;
+    }
+
+    bool await_ready()
+    {
+        return (sync.*TryAcquire)();
+    }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        handle = h;
+        (sync.*Enqueue)(this);
+    }
+
+    void await_resume() {}
+};
+#endif
+
+}// namespace benedias
+#endif
@@ -0,0 +1,222 @@
+/*
+
+Copyright (C) 2018  Blaise Dias
+
+This file is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This file is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this file.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <climits>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "bdfutex.h"
+#include "bdbarrier.h"
+
+namespace benedias {
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+//============================================================================
+latch::latch(int expected):count(expected)
+{
+    if (expected < 0)
+        throw std::invalid_argument("latch expected count is negative");
+}
+
+void latch::count_down(int n)
+{
+    static const char* _fn_err_txt = " benedias::latch::count_down";
+    int result = __atomic_sub_fetch(&count, n, __ATOMIC_SEQ_CST);
+    if (result < 0)
+        throw std::runtime_error("latch counted down below zero");
+    if (0 == result && __atomic_load_n(&waiters, __ATOMIC_SEQ_CST))
+        futex_wake(&count, INT_MAX, _fn_err_txt);
+}
+
+void latch::wait()
+{
+    static const char* _fn_err_txt = " benedias::latch::wait";
+    int v;
+    unsigned spins = std::thread::hardware_concurrency() > 1 ? barrier::spin_count : 0;
+    for (unsigned spin = 0; spin < spins; ++spin)
+    {
+        if (try_wait())
+            return;
+        cpu_relax();
+    }
+    __atomic_add_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+    while (0 != (v = __atomic_load_n(&count, __ATOMIC_SEQ_CST)))
+    {
+        futex_wait(&count, v, _fn_err_txt);
+    }
+    __atomic_sub_fetch(&waiters, 1, __ATOMIC_RELAXED);
+}
+
+//============================================================================
+struct barrier::tree_node
+{
+    int count;
+    int capacity;
+    tree_node* parent;
+    // Nodes are cache line sized and aligned, threads arriving
+    // at different nodes do not contend.
+    char pad[64 - 2 * sizeof(int) - sizeof(tree_node*)];
+};
+
+barrier::barrier(int nparticipants, std::function<void()> completion_fn)
+    :remaining(nparticipants), participants(nparticipants),
+    completion(completion_fn)
+{
+    if (nparticipants <= 0)
+        throw std::invalid_argument("barrier participant count must be positive");
+    unsigned ncpus = std::thread::hardware_concurrency();
+    if (ncpus > 1 && (unsigned)nparticipants <= ncpus)
+        spins = spin_count;
+    if ((unsigned)nparticipants <= tree_threshold)
+        return;
+
+    // Capacities of each level of the tree, leaves first.
+    std::vector<std::vector<int>> levels;
+    std::vector<int> level;
+    for (int left = nparticipants; left > 0; left -= tree_fanin)
+        level.push_back(left < (int)tree_fanin ? left : tree_fanin);
+    levels.push_back(level);
+    while (levels.back().size() > 1)
+    {
+        std::vector<int> parents;
+        for (int left = levels.back().size(); left > 0; left -= tree_fanin)
+            parents.push_back(left < (int)tree_fanin ? left : tree_fanin);
+        levels.push_back(parents);
+    }
+    for (auto &lvl : levels)
+        nnodes += lvl.size();
+    nleaves = levels[0].size();
+
+    void* mem;
+    if (posix_memalign(&mem, sizeof(tree_node), nnodes * sizeof(tree_node)))
+        throw std::bad_alloc();
+    nodes = static_cast<tree_node*>(mem);
+
+    unsigned base = 0;
+    for (unsigned ix_level = 0; ix_level < levels.size(); ++ix_level)
+    {
+        unsigned parent_base = base + levels[ix_level].size();
+        for (unsigned ix = 0; ix < levels[ix_level].size(); ++ix)
+        {
+            tree_node& node = nodes[base + ix];
+            node.count = 0;
+            node.capacity = levels[ix_level][ix];
+            node.parent = (ix_level + 1 < levels.size()) ?
+                &nodes[parent_base + ix / tree_fanin] : nullptr;
+        }
+        base = parent_base;
+    }
+}
+
+barrier::~barrier()
+{
+    free(nodes);
+}
+
+// returns true if this thread is the last to arrive in the phase.
+bool barrier::arrive_tree()
+{
+    static thread_local unsigned hint =
+        std::hash<std::thread::id>()(std::this_thread::get_id());
+    unsigned ix = hint % nleaves;
+    tree_node* node;
+    // Take a slot on a leaf, moving on to the next leaf if it is full.
+    // The leaf capacities sum to the number of participants,
+    // so there is always a free slot.
+    while (true)
+    {
+        node = &nodes[ix];
+        int c = __atomic_load_n(&node->count, __ATOMIC_RELAXED);
+        if (c >= node->capacity)
+        {
+            ix = (ix + 1) % nleaves;
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&node->count, &c, c + 1,
+                   false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            if (c + 1 < node->capacity)
+                return false;
+            break;
+        }
+    }
+    // Last arrival at the node, carry the arrival to the parent.
+    for (node = node->parent; node; node = node->parent)
+    {
+        if (__atomic_add_fetch(&node->count, 1, __ATOMIC_ACQ_REL) < node->capacity)
+            return false;
+    }
+    return true;
+}
+
+void barrier::complete_phase()
+{
+    static const char* _fn_err_txt = " benedias::barrier::complete_phase";
+    // All participants have arrived, and are waiting for the phase to
+    // change, so the counters can be reset without contention.
+    for (unsigned ix = 0; ix < nnodes; ++ix)
+        __atomic_store_n(&nodes[ix].count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&remaining, participants, __ATOMIC_RELAXED);
+    if (completion)
+        completion();
+    __atomic_add_fetch(&phase, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&waiters, __ATOMIC_SEQ_CST))
+        futex_wake(&phase, INT_MAX, _fn_err_txt);
+}
+
+void barrier::wait_phase(int arrival_phase)
+{
+    static const char* _fn_err_txt = " benedias::barrier::wait_phase";
+    for (unsigned spin = 0; spin < spins; ++spin)
+    {
+        if (arrival_phase != __atomic_load_n(&phase, __ATOMIC_ACQUIRE))
+            return;
+        cpu_relax();
+    }
+    __atomic_add_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+    while (arrival_phase == __atomic_load_n(&phase, __ATOMIC_SEQ_CST))
+    {
+        futex_wait(&phase, arrival_phase, _fn_err_txt);
+    }
+    __atomic_sub_fetch(&waiters, 1, __ATOMIC_RELAXED);
+}
+
+void barrier::arrive_and_wait()
+{
+    // The phase cannot change before this thread has arrived.
+    int arrival_phase = __atomic_load_n(&phase, __ATOMIC_ACQUIRE);
+    bool last;
+    if (nodes)
+        last = arrive_tree();
+    else
+        last = (1 == __atomic_fetch_sub(&remaining, 1, __ATOMIC_ACQ_REL));
+    if (last)
+        complete_phase();
+    else
+        wait_phase(arrival_phase);
+}
+
+} // namespace benedias
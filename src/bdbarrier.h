@@ -0,0 +1,134 @@
+/*
+
+Copyright (C) 2018  Blaise Dias
+
+This file is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This file is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this file.  If not, see <http://www.gnu.org/licenses/>.
+
+Classes implementing futex based latch and barrier.
+*/
+#ifndef BENEDIAS_BARRIER_H_INCLUDED
+#define BENEDIAS_BARRIER_H_INCLUDED
+
+#include <functional>
+
+namespace benedias {
+
+// @brief single use latch, threads wait until the count reaches zero.
+class latch
+{
+    // Non copyable
+    latch& operator=(const latch&) = delete;
+    latch(latch const&) = delete;
+
+    // Non movable
+    latch& operator=(latch&&) = delete;
+    latch(latch&&) = delete;
+
+    //@brief the count, and futex variable waiters wait on.
+    int count;
+    //@brief number of waiting threads, count_down only issues the wake
+    //syscall if there are waiting threads.
+    int waiters = 0;
+
+    public:
+    explicit latch(int expected);
+    ~latch(){}
+
+    //@brief decrement the count by n, waking waiters if it reaches zero.
+    void count_down(int n=1);
+    //@brief true if the count has reached zero.
+    bool try_wait() const
+    {
+        return 0 == __atomic_load_n(&count, __ATOMIC_ACQUIRE);
+    }
+    //@brief wait until the count reaches zero.
+    void wait();
+    //@brief count_down followed by wait.
+    void arrive_and_wait(int n=1)
+    {
+        count_down(n);
+        wait();
+    }
+};
+
+// @brief reusable barrier for a fixed number of participants.
+// The last thread to arrive in a phase runs the completion function,
+// and then releases all participants.
+//
+// For small numbers of participants, arrivals are counted on a single
+// sense reversing counter, the sense being the phase number.
+// For larger numbers of participants arrivals are counted on a combining
+// tree, so that at most tree_fanin threads contend on any counter.
+// The last arrival at a node carries the arrival up to its parent.
+// Threads need not identify themselves, an arriving thread takes any free
+// slot on a leaf, starting with a leaf selected by its thread id.
+//
+// Waiting threads spin for a short while before waiting on the phase
+// futex variable, provided that there is a CPU for every participant.
+// Release wakes all threads with a single syscall,
+// which is skipped if no thread is waiting.
+class barrier
+{
+    // Non copyable
+    barrier& operator=(const barrier&) = delete;
+    barrier(barrier const&) = delete;
+
+    // Non movable
+    barrier& operator=(barrier&&) = delete;
+    barrier(barrier&&) = delete;
+
+    struct tree_node;
+
+    //@brief the phase number, and futex variable waiters wait on.
+    int phase = 0;
+    //@brief number of waiting threads.
+    int waiters = 0;
+    //@brief arrivals remaining in this phase, for the single counter.
+    int remaining;
+    const int participants;
+    std::function<void()> completion;
+    //@brief iterations spent spinning before waiting on the futex,
+    //no spinning if the participants outnumber the CPUs.
+    unsigned spins = 0;
+
+    //@brief combining tree, leaves first, root last.
+    //NULL if the single counter is used.
+    tree_node* nodes = nullptr;
+    unsigned nnodes = 0;
+    unsigned nleaves = 0;
+
+    bool arrive_tree();
+    void complete_phase();
+    void wait_phase(int arrival_phase);
+
+    public:
+    //@brief participant count above which the combining tree is used.
+    static const unsigned tree_threshold = 16;
+    //@brief maximum number of arrivals counted on a tree node.
+    static const unsigned tree_fanin = 4;
+    //@brief maximum number of iterations spent spinning before waiting
+    //on the futex.
+    static const unsigned spin_count = 2000;
+
+    explicit barrier(int participants,
+            std::function<void()> completion_fn = std::function<void()>());
+    ~barrier();
+
+    //@brief arrive at the barrier and wait for all other participants
+    //to arrive.
+    void arrive_and_wait();
+};
+
+}// namespace benedias
+#endif
@@ -29,6 +29,7 @@ along with this file.  If not, see <http://www.gnu.org/licenses/>.
 #include <string>
 #include <stdexcept>
 #include <system_error>
+#include <climits>
 
 #include "bdfutex.h"
 #include "stacktrace.h"
@@ -85,6 +86,27 @@ int futex_wait(int *uaddr, int expected, const char *txt)
     return 0; // check and possibly try again
 }
 
+// Public
+int futex_wait_until(int *uaddr, int expected, const struct timespec *deadline,
+        const char *txt)
+{
+    // FUTEX_WAIT_BITSET takes an absolute timeout, unlike FUTEX_WAIT.
+    int rv = futex(uaddr, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, expected,
+            deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+    if (rv != 0)
+    {
+        if (errno == ETIMEDOUT)
+            return futex_op_timedout;
+        if (errno != EINTR && errno != EAGAIN)
+        {
+            // Things really have gone wrong!
+            // errno should only be EACCES, EINVAL.
+            futex_critical_error(txt);
+            return -1;
+        }
+    }
+    return 0; // check and possibly try again
+}
 
 // Public
 int futex_lock_pi(pid_t *uaddr, const char *txt)
@@ -146,4 +168,45 @@ int futex_unlock_pi(pid_t *uaddr, const char *txt)
 }
 
 
+// Eventcount
+void eventcount::commit_wait(int key)
+{
+    static const char* _fn_err_txt = " benedias::eventcount::commit_wait";
+    int v;
+    while (key == ((v = __atomic_load_n(&state, __ATOMIC_SEQ_CST)) & ~1))
+    {
+        futex_wait(&state, v, _fn_err_txt);
+    }
+}
+
+bool eventcount::commit_wait_until(int key, const struct timespec *deadline)
+{
+    static const char* _fn_err_txt = " benedias::eventcount::commit_wait_until";
+    int v;
+    while (key == ((v = __atomic_load_n(&state, __ATOMIC_SEQ_CST)) & ~1))
+    {
+        if (futex_op_timedout == futex_wait_until(&state, v, deadline, _fn_err_txt))
+            return key != (__atomic_load_n(&state, __ATOMIC_SEQ_CST) & ~1);
+    }
+    return true;
+}
+
+void eventcount::notify_waiters()
+{
+    static const char* _fn_err_txt = " benedias::eventcount::notify";
+    int v = __atomic_load_n(&state, __ATOMIC_RELAXED);
+    while (v & 1)
+    {
+        // Adding 1 to an odd value clears the waiters bit, and advances
+        // the epoch.
+        int desired = (int)((unsigned)v + 1u);
+        if (__atomic_compare_exchange_n(&state, &v, desired,
+                   false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+            futex_wake(&state, INT_MAX, _fn_err_txt);
+            return;
+        }
+    }
+}
+
 };
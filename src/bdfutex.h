@@ -20,6 +20,7 @@ along with this file.  If not, see <http://www.gnu.org/licenses/>.
 #define BENEDIAS_BDFUTEX_H_INCLUDED
 
 #include <sys/types.h>
+#include <time.h>
 
 namespace benedias {
 
@@ -27,6 +28,7 @@ enum {
     futex_op_success = 0,
     futex_op_failed = -1,
     futex_op_invalid = -2,
+    futex_op_timedout = -3,
 };
 
 typedef void (*critical_error)(const char*);
@@ -35,9 +37,87 @@ extern critical_error   futex_critical_error;
 
 int futex_wake(int *uaddr, int wake_count, const char* txt);
 int futex_wait(int *uaddr, int expected, const char *txt);
+// deadline is absolute, measured against CLOCK_MONOTONIC.
+// returns futex_op_timedout if the deadline has passed.
+int futex_wait_until(int *uaddr, int expected, const struct timespec *deadline,
+        const char *txt);
 
 int futex_unlock_pi(pid_t *uaddr, const char *txt);
 int futex_lock_pi(pid_t *uaddr, const char *txt);
 
+// Eventcount, for parking threads waiting on a condition which is
+// published without locks, for example an item in a lock free queue.
+// Based on Dmitry Vyukov's eventcount.
+//
+// Consumer:
+//      if (condition) ...
+//      key = ec.prepare_wait();
+//      if (condition) { ec.cancel_wait(); ... }
+//      else ec.commit_wait(key);
+// Producer:
+//      make condition true
+//      ec.notify();
+//
+// The state is a single futex variable, bit 0 is set when there are
+// waiters, the remaining bits are the epoch, which notify advances.
+// A waiter never sleeps if notify was called after its prepare_wait,
+// so the condition can be safely re-checked between prepare and commit.
+class eventcount
+{
+    // Non copyable
+    eventcount& operator=(const eventcount&) = delete;
+    eventcount(eventcount const&) = delete;
+
+    // Non movable
+    eventcount& operator=(eventcount&&) = delete;
+    eventcount(eventcount&&) = delete;
+
+    int state = 0;
+    void notify_waiters();
+
+    public:
+    eventcount(){}
+
+    //@brief announce the intention to wait.
+    //@returns the key to be passed to commit_wait.
+    inline int prepare_wait()
+    {
+        return __atomic_fetch_or(&state, 1, __ATOMIC_SEQ_CST) & ~1;
+    }
+
+    //@brief the condition became true after prepare_wait, do not wait.
+    //The waiters bit is left set, so the next notify makes a redundant
+    //wake syscall, keeping notify free of any waiter accounting.
+    inline void cancel_wait() {}
+
+    //@brief wait until notify has been called after prepare_wait returned key.
+    void commit_wait(int key);
+
+    //@brief as commit_wait, giving up at deadline, which is absolute,
+    //measured against CLOCK_MONOTONIC.
+    //@returns false if the deadline passed before notify was called.
+    bool commit_wait_until(int key, const struct timespec *deadline);
+
+    //@brief wake all waiters, if any.
+    //If there are no waiters, the cost is a single load.
+    //The condition MUST have been published using a sequentially consistent
+    //atomic operation, as is typically the case for lock free structures
+    //(compare and exchange, exchange, fetch and add...), otherwise use
+    //fence_and_notify.
+    inline void notify()
+    {
+        if (__atomic_load_n(&state, __ATOMIC_SEQ_CST) & 1)
+            notify_waiters();
+    }
+
+    //@brief as notify, for conditions published with plain stores,
+    //or with weaker than sequentially consistent atomic operations.
+    inline void fence_and_notify()
+    {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        notify();
+    }
+};
+
 } // namespace
 #endif
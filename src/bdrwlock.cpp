@@ -152,10 +152,59 @@ void sem_rw_lock::write_unlock()
 void futex_rw_control::read_lock()
 {
     static const char* _fn_err_txt = " fu_read_lock::lock";
-    enter_gate(&gate, _fn_err_txt);
-    // @here if there are no active writers
-    __atomic_add_fetch(&nreaders, 1, __ATOMIC_RELEASE);
-    leave_gate(&gate, _fn_err_txt);
+    int seq;
+    while (!try_read_lock(&seq))
+    {
+        // A writer is active, park on wseq, all parked readers are
+        // released together by write_unlock.
+        __atomic_add_fetch(&waiting_readers, 1, __ATOMIC_SEQ_CST);
+        while (seq == __atomic_load_n(&wseq, __ATOMIC_SEQ_CST))
+        {
+            futex_wait(&wseq, seq, _fn_err_txt);
+        }
+        __atomic_sub_fetch(&waiting_readers, 1, __ATOMIC_RELAXED);
+    }
+}
+
+bool futex_rw_control::try_read_lock(int *seq)
+{
+    static const char* _fn_err_txt = " fu_read_lock::try_lock";
+    // Optimistically register as a reader, and then check for writers.
+    // Pairs with the increment of wseq and decrement of nreaders in
+    // begin_write, so either this reader sees the writer, or the writer
+    // waits for this reader.
+    __atomic_add_fetch(&nreaders, 1, __ATOMIC_SEQ_CST);
+    int vseq = __atomic_load_n(&wseq, __ATOMIC_SEQ_CST);
+    if (0 == (vseq & 1))
+        return true;
+    // @here if there is an active writer, back out,
+    // waking the writer if it is waiting for this reader.
+    // A writer sets waiting_writer before its decrement of nreaders, so
+    // a negative count here follows the set.
+    if (0 > __atomic_sub_fetch(&nreaders, 1, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&waiting_writer, __ATOMIC_SEQ_CST))
+    {
+        futex_wake(&nreaders, 1, _fn_err_txt);
+    }
+    if (seq)
+        *seq = vseq;
+    return false;
+}
+
+bool futex_rw_control::try_read_lock()
+{
+    return try_read_lock(NULL);
+}
+
+void futex_rw_control::async_read_enqueue(async_waiter* waiter)
+{
+    async_readers.push(waiter);
+    // If the writer has already released, write_unlock may have missed
+    // the waiter, so notify now.
+    if (0 == (__atomic_load_n(&wseq, __ATOMIC_SEQ_CST) & 1))
+    {
+        async_readers.notify_all();
+    }
 }
 
 void futex_rw_control::read_unlock()
@@ -172,18 +221,19 @@ void futex_rw_control::read_unlock()
     }
 }
 
-void futex_rw_control::write_lock()
+// Called with the gate held, stops new readers and waits for existing
+// read locks to be released.
+void futex_rw_control::begin_write(const char* _fn_err_txt)
 {
-    static const char* _fn_err_txt = " fu_write_lock::lock";
     int val_nreaders;
-    enter_gate(&gate, _fn_err_txt);
-    // gate is unavailable for the duration of the write,
-    // including the wait for readers to complete.
-    // atomically decrement of nreaders, 
+    // wseq is odd for the duration of the write, new readers back out.
+    __atomic_add_fetch(&wseq, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&waiting_writer, 1, __ATOMIC_SEQ_CST);
+    // atomically decrement of nreaders,
     // if at least 1 reader final value is >= 0, so we must wait.
     // readers detect that there is a waiter when decrementing nreaders
     // yields a negative value.
-    if (0 <= (val_nreaders = __atomic_sub_fetch(&nreaders, 1, __ATOMIC_ACQ_REL)))
+    if (0 <= (val_nreaders = __atomic_sub_fetch(&nreaders, 1, __ATOMIC_SEQ_CST)))
     {
         do
         {
@@ -191,13 +241,33 @@ void futex_rw_control::write_lock()
             __atomic_load(&nreaders, &val_nreaders, __ATOMIC_CONSUME);
         }while(val_nreaders >= 0);
     }
+    __atomic_store_n(&waiting_writer, 0, __ATOMIC_RELAXED);
+}
+
+void futex_rw_control::write_lock()
+{
+    static const char* _fn_err_txt = " fu_write_lock::lock";
+    enter_gate(&gate, _fn_err_txt);
+    // gate is unavailable for the duration of the write,
+    // including the wait for readers to complete.
+    begin_write(_fn_err_txt);
 }
 
 void futex_rw_control::write_unlock()
 {
     static const char* _fn_err_txt = " fu_write_lock::unlock";
-    __atomic_store_n(&nreaders, 0, __ATOMIC_RELEASE);
+    // Readers backing out whilst the write was active may transiently
+    // change nreaders, so remove the writer's decrement rather than
+    // storing 0.
+    __atomic_add_fetch(&nreaders, 1, __ATOMIC_RELEASE);
+    // Admit all parked readers at once.
+    __atomic_add_fetch(&wseq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&waiting_readers, __ATOMIC_SEQ_CST))
+    {
+        futex_wake(&wseq, INT_MAX, _fn_err_txt);
+    }
     leave_gate(&gate, _fn_err_txt);
+    async_readers.notify_all();
 }
 
 bool futex_rw_control::try_write_modify()
@@ -205,16 +275,9 @@ bool futex_rw_control::try_write_modify()
     static const char* _fn_err_txt = " futex_rw_control::try_write_modify";
     if (try_enter_gate(&gate, _fn_err_txt))
     {
+        // Give up this thread's read lock, it is replaced by the write lock.
         __atomic_sub_fetch(&nreaders, 1, __ATOMIC_ACQ_REL);
-        int val_nreaders;
-        if (0 <= (val_nreaders = __atomic_sub_fetch(&nreaders, 1, __ATOMIC_ACQ_REL)))
-        {
-            do
-            {
-                futex_wait(&nreaders, val_nreaders, _fn_err_txt);
-                __atomic_load(&nreaders, &val_nreaders, __ATOMIC_CONSUME);
-            }while(val_nreaders >= 0);
-        }
+        begin_write(_fn_err_txt);
         return true;
     }
     return false;
@@ -229,18 +292,10 @@ void futex_rw_control::write_modify()
     {
         futex_wake(&nreaders, 1, _fn_err_txt);
     }
-    int val_nreaders;
     enter_gate(&gate, _fn_err_txt);
     // gate is unavailable for the duration of the write,
     // including the wait for readers to complete.
-    if (0 <= (val_nreaders = __atomic_sub_fetch(&nreaders, 1, __ATOMIC_ACQ_REL)))
-    {
-        do
-        {
-            futex_wait(&nreaders, val_nreaders, _fn_err_txt);
-            __atomic_load(&nreaders, &val_nreaders, __ATOMIC_CONSUME);
-        }while(val_nreaders >= 0);
-    }
+    begin_write(_fn_err_txt);
 }
 
 futex_rw_control::~futex_rw_control()
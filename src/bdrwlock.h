@@ -46,11 +46,14 @@ The rules are simple and harsh:
 #ifndef BENEDIAS_RWLOCK_H_INCLUDED
 #define BENEDIAS_RWLOCK_H_INCLUDED
 
+#include "bdasync.h"
+
 namespace benedias {
 // @brief simple futex based read write lock
-// Should have FIFO behaviour for threads of the same priority,
-// if futex wait implements FIFO dequeing on thread wake,
-// which is expected for fair thread scheduling.
+// Writers are preferred, once a writer holds the gate new readers back out
+// and park on wseq, and are all released together by write_unlock.
+// Writers are serialised by the gate, there is no ordering between
+// readers and writers waiting at the same time.
 class futex_rw_control
 {
     // Non copyable
@@ -61,27 +64,44 @@ class futex_rw_control
     futex_rw_control& operator=(futex_rw_control&&) = delete;
     futex_rw_control(futex_rw_control&&) = delete;
 
-    //@brief this is the futex variable used as a mutex.
-    //for read lock the gate is acquired, the number of readers is incremented,
-    //and then the gate is released.
-    //for read unlock the gate is not acquired.
+    //@brief this is the futex variable used as a mutex between writers.
     //for write lock the gate is acquired for the duration of the write
-    //for write lock the gate is released.
+    //for write unlock the gate is released.
+    //readers do not acquire the gate.
     int gate = 0;
     //@brief this is the count of readers and futex variable used to wake
     //writers if any.
     int nreaders = 0;
+    //@brief write sequence, odd whilst a writer holds the gate.
+    //Futex variable on which readers wait for the writer to finish,
+    //write_unlock releases all waiting readers with a single wake.
+    int wseq = 0;
+    //@brief number of readers waiting on wseq, so that write_unlock only
+    //issues the wake syscall if there are readers waiting.
+    int waiting_readers = 0;
+    //@brief set whilst a writer waits on nreaders for readers to unlock,
+    //so that readers backing out only wake a writer which is waiting.
+    int waiting_writer = 0;
+    //@brief coroutines waiting for a read lock, notified on write_unlock.
+    async_wait_list async_readers;
+
+    bool try_read_lock(int *seq);
+    void begin_write(const char* _fn_err_txt);
 
     public:
     futex_rw_control(){}
     ~futex_rw_control();
-    //@brief acquires the gate, and atomically increments nreaders.
+    //@brief atomically increments nreaders, if a writer is active
+    //backs out and waits on wseq till the write is complete.
     void read_lock();
+    //@brief acquires a read lock if there is no active writer.
+    bool try_read_lock();
     //@brief atomically decrements nreaders and wakes pending writer if any.
     void read_unlock();
     //@brief acquires the gate, and wait for existing read locks to be released, if any.
     void write_lock();
-    //@brief releases the gate, and wakes pending readers or writers if any.
+    //@brief releases the gate, wakes all pending readers,
+    //and a pending writer if any.
     void write_unlock();
 
     // The following functions make it possible to used a single lock
@@ -97,6 +117,25 @@ class futex_rw_control
     //@change a read lock into a write lock,
     //
     void write_modify();
+
+    //@brief enqueue an asynchronous waiter for a read lock,
+    //the waiter is notified on write_unlock.
+    void async_read_enqueue(async_waiter* waiter);
+
+#if defined(__cpp_impl_coroutine)
+    typedef async_acquire_awaiter<futex_rw_control,
+            &futex_rw_control::try_read_lock,
+            &futex_rw_control::async_read_enqueue> read_lock_awaiter;
+
+    //@brief awaitable read lock, the coroutine is suspended instead of
+    //blocking the thread, and resumed on executor holding the read lock.
+    //The lock is released by calling read_unlock.
+    inline read_lock_awaiter async_read_lock(
+            async_executor& executor=inline_executor::instance())
+    {
+        return read_lock_awaiter(*this, executor);
+    }
+#endif
 };
 
 // @brief simple futex based write only lock using a futex_rw_control instance
@@ -0,0 +1,201 @@
+/*
+
+Copyright (C) 2016  Blaise Dias
+
+hp_snapshot is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+hp_snapshot is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with hp_snapshot.  If not, see <http://www.gnu.org/licenses/>. *
+*/
+
+#ifndef _HP_SNAPSHOT_HPP_INCLUDED
+#define _HP_SNAPSHOT_HPP_INCLUDED
+#include <atomic>
+#include <utility>
+#include "HazardPointer.hpp"
+
+namespace benedias {
+namespace concurrent {
+
+/**
+ * \class hp_snapshot
+ *
+ * The current version of a read mostly object, for example configuration
+ * or a routing table. Readers load a view, which protects the version with
+ * a hazard pointer, so a load is a validated publish of a pointer and takes
+ * no lock. Writers replace the version, the replaced version is retired to
+ * the HazardPointerList, and deleted once no view refers to it.
+ * Versions are immutable once published, and are deleted by the
+ * HazardPointerList, so must be allocated with new.
+ */
+template <typename T> class hp_snapshot {
+    HazardPointerList<T>& hplist;
+    std::atomic<T*> current;
+
+    /// Retire a replaced version, which cannot fail, a version is
+    /// unreachable once replaced.
+    inline void retire(T* old)
+    {
+        if (old)
+            hplist.RetireDeleted(old);
+    }
+
+ public:
+    /**
+     * \class view
+     *
+     * A protected version, valid until the view is reset or destroyed,
+     * regardless of later updates. Views are movable, but not copyable.
+     * If the node limit of the HazardPointerList was reached with
+     * HazardNodePolicy::k_FAIL, the view is unbound and empty, IsBound
+     * distinguishes it from a view of no version.
+     */
+    class view {
+        friend class hp_snapshot<T>;
+        HazardPointer<T> hp;
+        T* ptr;
+
+        view(HazardPointerList<T>& hplist, const std::atomic<T*>& src)
+            :hp(hplist)
+        {
+            ptr = hp.protect(src);
+        }
+
+     public:
+        view(view&& other):hp(std::move(other.hp)), ptr(other.ptr)
+        {
+            other.ptr = NULL;
+        }
+        view(const view&) = delete;
+        view& operator=(const view&) = delete;
+        view& operator=(view&&) = delete;
+
+        /// \returns the version, NULL if there was none or the view
+        /// has been reset.
+        inline const T* get() const { return ptr; }
+        inline const T& operator*() const { return *ptr; }
+        inline const T* operator->() const { return ptr; }
+        explicit operator bool() const { return ptr != NULL; }
+
+        /// \returns false if no hazard pointer record was available,
+        /// and the version could not be loaded.
+        inline bool IsBound() const { return hp.IsBound(); }
+
+        /// Drops the protection, the version may be deleted.
+        inline void reset()
+        {
+            hp.Release();
+            ptr = NULL;
+        }
+    };
+
+    // Non copyable, non movable.
+    hp_snapshot(const hp_snapshot&) = delete;
+    hp_snapshot& operator=(const hp_snapshot&) = delete;
+    hp_snapshot(hp_snapshot&&) = delete;
+    hp_snapshot& operator=(hp_snapshot&&) = delete;
+
+    /// \param hplist the HazardPointerList which protects and deletes
+    /// the versions.
+    /// \param initial the initial version, may be NULL.
+    explicit hp_snapshot(HazardPointerList<T>& hplist, T* initial = NULL)
+        :hplist(hplist), current(initial)
+    {
+    }
+
+    /// Retires the current version, views must not outlive the
+    /// hp_snapshot.
+    ~hp_snapshot()
+    {
+        retire(current.exchange(NULL, std::memory_order_acq_rel));
+    }
+
+    /// \returns a view of the current version.
+    inline view load() const
+    {
+        return view(hplist, current);
+    }
+
+    /// Protects the current version with a hazard pointer the caller
+    /// owns, avoiding the acquisition of a hazard pointer record per
+    /// load, for readers in loops.
+    /// \returns the current version, valid until hp is reused or released,
+    /// NULL if hp is not bound.
+    inline const T* load(HazardPointer<T>& hp) const
+    {
+        return hp.protect(current);
+    }
+
+    /// Publishes a new version, and retires the replaced version.
+    /// \param next the new version, may be NULL.
+    inline void publish(T* next)
+    {
+        retire(current.exchange(next, std::memory_order_acq_rel));
+    }
+
+    /// Read-modify-write of the current version, writers do not block
+    /// each other or readers, a writer which loses a race retries with
+    /// the version which won.
+    /// \param fn invoked with the current version, which may be NULL,
+    /// returns the new version, or NULL to leave the current version
+    /// unchanged. fn may be invoked more than once, and new versions it
+    /// returned which were not published are deleted.
+    /// \returns true if a new version was published, false if fn
+    /// abandoned the update, or no hazard pointer record was available
+    /// with HazardNodePolicy::k_FAIL, in which case fn is not invoked.
+    template <typename F> bool update(F&& fn)
+    {
+        HazardPointer<T> hp(hplist);
+        if (!hp.IsBound())
+            return false;
+        T* old = hp.protect(current);
+        while (true)
+        {
+            T* next = fn(static_cast<const T*>(old));
+            if (NULL == next)
+                return false;
+            if (current.compare_exchange_strong(old, next,
+                        std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                hp.Release();
+                retire(old);
+                return true;
+            }
+            delete next;
+            // old was updated with the winning version, which must be
+            // protected before it is read.
+            while (!hp.try_protect(old, current))
+            {
+            }
+        }
+    }
+
+    /// Read-copy-update of the current version, the version is copied,
+    /// the copy is modified by fn, and published if the current version
+    /// is unchanged, otherwise the sequence is repeated.
+    /// \param fn invoked with a copy of the current version, returns
+    /// false to abandon the update. The current version must not be NULL.
+    /// \returns true if a new version was published, false as for update.
+    template <typename F> bool copy_update(F&& fn)
+    {
+        return update([&fn](const T* old) -> T* {
+            T* next = new T(*old);
+            if (fn(*next))
+                return next;
+            delete next;
+            return NULL;
+        });
+    }
+};
+
+} // namespace concurrent
+} // namespace benedias
+#endif  // _HP_SNAPSHOT_HPP_INCLUDED
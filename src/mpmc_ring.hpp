@@ -0,0 +1,384 @@
+/*
+
+Copyright (C) 2016  Blaise Dias
+
+mpmc_ring is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+mpmc_ring is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mpmc_ring.  If not, see <http://www.gnu.org/licenses/>. *
+*/
+
+#ifndef _MPMC_RING_HPP_INCLUDED
+#define _MPMC_RING_HPP_INCLUDED
+#include <stdint.h>
+#include <time.h>
+#include <chrono>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include "bdfutex.h"
+
+namespace benedias {
+namespace concurrent {
+
+/**
+ * \class mpmc_ring
+ *
+ * Bounded multi producer, multi consumer FIFO queue, Dmitry Vyukov's
+ * ring of slots with sequence numbers. A slot's sequence number is its
+ * position when free, and its position + 1 when full, so producers and
+ * consumers claim positions with a single compare and swap, and hand
+ * over each slot with a store. The positions and the futex words are on
+ * cache lines of their own. Nothing is allocated after construction.
+ * Blocking operations spin briefly, then park on an eventcount, only
+ * whilst the ring is full, or empty. The items of a thread's batch are
+ * contiguous in the ring, batches cost a single claim and a single
+ * notify.
+ * Items are moved in and out, the move constructor and move assignment
+ * of T must not throw.
+ */
+template <typename T> class mpmc_ring {
+    static const size_t k_LINE = 64;
+    /// Attempts before parking, on multiprocessors.
+    static const unsigned k_SPINS = 100;
+
+    struct slot {
+        size_t seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+        inline T* value() { return reinterpret_cast<T*>(storage); }
+    };
+
+    slot* slots;
+    size_t mask;
+    unsigned spins = 0;
+    bool closed = false;
+    alignas(k_LINE) size_t enqueue_pos = 0;
+    alignas(k_LINE) size_t dequeue_pos = 0;
+    alignas(k_LINE) eventcount not_empty;
+    alignas(k_LINE) eventcount not_full;
+
+    static inline void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    static inline struct timespec to_timespec(std::chrono::steady_clock::time_point deadline)
+    {
+        // steady_clock is CLOCK_MONOTONIC.
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                deadline.time_since_epoch()).count();
+        struct timespec ts;
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        return ts;
+    }
+
+    /// Claims up to n consecutive slots for writing.
+    /// \returns the number of slots claimed, from position pos.
+    size_t claim_push(size_t& pos, size_t n)
+    {
+        pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        while (true)
+        {
+            size_t count = 0;
+            while (count < n && __atomic_load_n(&slots[(pos + count) & mask].seq,
+                        __ATOMIC_ACQUIRE) == pos + count)
+                ++count;
+            if (count == 0)
+            {
+                size_t seq = __atomic_load_n(&slots[pos & mask].seq, __ATOMIC_ACQUIRE);
+                if ((intptr_t)(seq - pos) < 0)
+                    return 0;   // full
+                pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+                continue;
+            }
+            // A slot free for position p is only written by the producer
+            // which claims p, so the slots remain free once claimed.
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + count,
+                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return count;
+        }
+    }
+
+    /// Claims up to n consecutive slots for reading.
+    /// \returns the number of slots claimed, from position pos.
+    size_t claim_pop(size_t& pos, size_t n)
+    {
+        pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+        while (true)
+        {
+            size_t count = 0;
+            while (count < n && __atomic_load_n(&slots[(pos + count) & mask].seq,
+                        __ATOMIC_ACQUIRE) == pos + count + 1)
+                ++count;
+            if (count == 0)
+            {
+                size_t seq = __atomic_load_n(&slots[pos & mask].seq, __ATOMIC_ACQUIRE);
+                if ((intptr_t)(seq - (pos + 1)) < 0)
+                    return 0;   // empty
+                pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+                continue;
+            }
+            if (__atomic_compare_exchange_n(&dequeue_pos, &pos, pos + count,
+                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return count;
+        }
+    }
+
+    /// Hands over claimed slots to consumers. The stores are release
+    /// stores, a single fence orders the batch before the eventcount
+    /// reads its waiters.
+    inline void publish_push(size_t pos, size_t count)
+    {
+        for (size_t ix = 0; ix < count; ++ix)
+            __atomic_store_n(&slots[(pos + ix) & mask].seq, pos + ix + 1, __ATOMIC_RELEASE);
+        not_empty.fence_and_notify();
+    }
+
+    /// Returns claimed slots to producers.
+    inline void publish_pop(size_t pos, size_t count)
+    {
+        for (size_t ix = 0; ix < count; ++ix)
+            __atomic_store_n(&slots[(pos + ix) & mask].seq, pos + ix + mask + 1,
+                    __ATOMIC_RELEASE);
+        not_full.fence_and_notify();
+    }
+
+    /// Waits until try_op succeeds, the ring is closed, or the deadline
+    /// passes, ec is notified when try_op may succeed.
+    /// \returns the result of the last try_op.
+    template <typename OP> size_t wait(eventcount& ec, OP try_op,
+            const struct timespec* deadline)
+    {
+        size_t done;
+        for (unsigned spin = 0; spin < spins; ++spin)
+        {
+            if ((done = try_op()) != 0)
+                return done;
+            cpu_relax();
+        }
+        while (true)
+        {
+            if ((done = try_op()) != 0)
+                return done;
+            int key = ec.prepare_wait();
+            if ((done = try_op()) != 0 || __atomic_load_n(&closed, __ATOMIC_SEQ_CST))
+            {
+                ec.cancel_wait();
+                return done;
+            }
+            if (deadline)
+            {
+                if (!ec.commit_wait_until(key, deadline))
+                    return try_op();
+            }
+            else
+                ec.commit_wait(key);
+        }
+    }
+
+ public:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    // Non copyable, non movable.
+    mpmc_ring(const mpmc_ring&) = delete;
+    mpmc_ring& operator=(const mpmc_ring&) = delete;
+    mpmc_ring(mpmc_ring&&) = delete;
+    mpmc_ring& operator=(mpmc_ring&&) = delete;
+
+    /// \param capacity the number of slots, a power of two, at least 2.
+    explicit mpmc_ring(size_t capacity)
+    {
+        if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+            throw std::invalid_argument("mpmc_ring capacity is not a power of two");
+        slots = new slot[capacity];
+        mask = capacity - 1;
+        for (size_t ix = 0; ix < capacity; ++ix)
+            slots[ix].seq = ix;
+        if (std::thread::hardware_concurrency() > 1)
+            spins = k_SPINS;
+    }
+
+    /// Destructor, NOT thread safe, items remaining in the ring are
+    /// destroyed.
+    ~mpmc_ring()
+    {
+        for (size_t pos = dequeue_pos; pos != enqueue_pos; ++pos)
+            slots[pos & mask].value()->~T();
+        delete[] slots;
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+    /// \returns the number of items, the result may be stale.
+    size_t size() const
+    {
+        size_t tail = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+        size_t head = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        return (intptr_t)(head - tail) > 0 ? head - tail : 0;
+    }
+
+    /// \returns false if the ring is full.
+    bool try_push(T&& value)
+    {
+        size_t pos;
+        if (0 == claim_push(pos, 1))
+            return false;
+        new (slots[pos & mask].value()) T(std::move(value));
+        publish_push(pos, 1);
+        return true;
+    }
+
+    bool try_push(const T& value)
+    {
+        T copy(value);
+        return try_push(std::move(copy));
+    }
+
+    /// \returns false if the ring is empty.
+    bool try_pop(T& value)
+    {
+        size_t pos;
+        if (0 == claim_pop(pos, 1))
+            return false;
+        T* item = slots[pos & mask].value();
+        value = std::move(*item);
+        item->~T();
+        publish_pop(pos, 1);
+        return true;
+    }
+
+    /// Moves up to n items from items into the ring, as a contiguous batch.
+    /// \returns the number of items pushed, 0 if the ring is full.
+    size_t try_push_n(T* items, size_t n)
+    {
+        size_t pos;
+        size_t count = claim_push(pos, n);
+        for (size_t ix = 0; ix < count; ++ix)
+            new (slots[(pos + ix) & mask].value()) T(std::move(items[ix]));
+        if (count)
+            publish_push(pos, count);
+        return count;
+    }
+
+    /// Moves up to n items from the ring into items.
+    /// \returns the number of items popped, 0 if the ring is empty.
+    size_t try_pop_n(T* items, size_t n)
+    {
+        size_t pos;
+        size_t count = claim_pop(pos, n);
+        for (size_t ix = 0; ix < count; ++ix)
+        {
+            T* item = slots[(pos + ix) & mask].value();
+            items[ix] = std::move(*item);
+            item->~T();
+        }
+        if (count)
+            publish_pop(pos, count);
+        return count;
+    }
+
+    /// Pushes value, waiting whilst the ring is full.
+    /// \returns false if the ring was closed.
+    bool push(T&& value)
+    {
+        if (__atomic_load_n(&closed, __ATOMIC_RELAXED))
+            return false;
+        return 0 != wait(not_full, [&]{ return (size_t)try_push(std::move(value)); }, NULL);
+    }
+
+    bool push(const T& value)
+    {
+        T copy(value);
+        return push(std::move(copy));
+    }
+
+    /// Pushes value, waiting until deadline whilst the ring is full.
+    /// \returns false if the ring was closed, or the deadline passed.
+    bool push_until(T&& value, time_point deadline)
+    {
+        if (__atomic_load_n(&closed, __ATOMIC_RELAXED))
+            return false;
+        struct timespec ts = to_timespec(deadline);
+        return 0 != wait(not_full, [&]{ return (size_t)try_push(std::move(value)); }, &ts);
+    }
+
+    /// Pops an item, waiting whilst the ring is empty.
+    /// \returns false if the ring is empty and was closed.
+    bool pop(T& value)
+    {
+        return 0 != wait(not_empty, [&]{ return (size_t)try_pop(value); }, NULL);
+    }
+
+    /// Pops an item, waiting until deadline whilst the ring is empty.
+    /// \returns false if the ring is empty, and was closed or the
+    /// deadline passed.
+    bool pop_until(T& value, time_point deadline)
+    {
+        struct timespec ts = to_timespec(deadline);
+        return 0 != wait(not_empty, [&]{ return (size_t)try_pop(value); }, &ts);
+    }
+
+    /// Moves n items into the ring, in batches as space becomes available,
+    /// waiting whilst the ring is full.
+    /// \returns the number of items pushed, less than n if the ring
+    /// was closed.
+    size_t push_n(T* items, size_t n)
+    {
+        size_t done = 0;
+        while (done < n && !__atomic_load_n(&closed, __ATOMIC_RELAXED))
+        {
+            size_t count = wait(not_full,
+                    [&]{ return try_push_n(items + done, n - done); }, NULL);
+            if (count == 0)
+                break;
+            done += count;
+        }
+        return done;
+    }
+
+    /// Moves up to n items from the ring into items, waiting whilst the
+    /// ring is empty.
+    /// \returns the number of items popped, 0 if the ring is empty and
+    /// was closed.
+    size_t pop_n(T* items, size_t n)
+    {
+        return wait(not_empty, [&]{ return try_pop_n(items, n); }, NULL);
+    }
+
+    /// As pop_n, waiting until deadline whilst the ring is empty.
+    /// \returns the number of items popped, 0 if the ring is empty, and
+    /// was closed or the deadline passed.
+    size_t pop_n_until(T* items, size_t n, time_point deadline)
+    {
+        struct timespec ts = to_timespec(deadline);
+        return wait(not_empty, [&]{ return try_pop_n(items, n); }, &ts);
+    }
+
+    /// Wakes blocked producers and consumers, push fails, and pop no
+    /// longer waits once the ring is empty.
+    void close()
+    {
+        __atomic_store_n(&closed, true, __ATOMIC_SEQ_CST);
+        not_empty.notify();
+        not_full.notify();
+    }
+};
+
+} // namespace concurrent
+} // namespace benedias
+#endif  // _MPMC_RING_HPP_INCLUDED
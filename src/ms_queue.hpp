@@ -0,0 +1,355 @@
+/*
+
+Copyright (C) 2016  Blaise Dias
+
+ms_queue is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+ms_queue is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with ms_queue.  If not, see <http://www.gnu.org/licenses/>. *
+*/
+
+#ifndef _MS_QUEUE_HPP_INCLUDED
+#define _MS_QUEUE_HPP_INCLUDED
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <utility>
+#include "HazardPointer.hpp"
+#include "bdfutex.h"
+
+namespace benedias {
+namespace concurrent {
+
+/**
+ * \class ms_queue
+ *
+ * Unbounded multi producer, multi consumer FIFO queue, the lock free
+ * algorithm of Michael and Scott. Nodes are protected with hazard pointers,
+ * dequeued nodes are retired to a HazardPointerList private to the queue,
+ * and once no hazard pointer protects them are returned to a pool for
+ * reuse, so steady state enqueues do not allocate.
+ * pop blocks on an eventcount whilst the queue is empty, producers only
+ * make a system call if a consumer is waiting.
+ */
+template <typename T> class ms_queue {
+    struct node_pool;
+
+    struct node {
+        std::atomic<node*> next;
+        node_pool* pool;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        explicit node(node_pool* pool):next(NULL), pool(pool) {}
+        inline T* value() { return reinterpret_cast<T*>(storage); }
+    };
+
+    /**
+     * Pool of free nodes. Nodes are returned by the HazardPointerList,
+     * either by a collector, or on exit of a thread holding a batch of
+     * retired nodes, which may be after the queue was destroyed.
+     * So the pool is reference counted, by the queue and by every node
+     * allocated from it, and deleted when the last reference is dropped.
+     * Nodes are pushed without a lock, nodes are popped under a lock,
+     * a single remover is not subject to the ABA problem.
+     */
+    struct node_pool {
+        node* head = NULL;
+        size_t count = 0;
+        size_t limit;
+        unsigned long refs = 1;
+        bool closed = false;
+        std::mutex pop_lock;
+
+        explicit node_pool(size_t limit):limit(limit) {}
+
+        inline void AddRef()
+        {
+            __atomic_add_fetch(&refs, 1, __ATOMIC_RELAXED);
+        }
+
+        inline void DropRef()
+        {
+            if (0 == __atomic_sub_fetch(&refs, 1, __ATOMIC_ACQ_REL))
+                delete this;
+        }
+
+        /// Delete a node, which is not in the pool.
+        inline void Free(node* n)
+        {
+            delete n;
+            DropRef();
+        }
+
+        node* Alloc()
+        {
+            if (__atomic_load_n(&head, __ATOMIC_RELAXED) != NULL)
+            {
+                std::lock_guard<std::mutex> lockg(pop_lock);
+                node* n = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+                while (n && !__atomic_compare_exchange_n(&head, &n,
+                            n->next.load(std::memory_order_relaxed), false,
+                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                {
+                }
+                if (n)
+                {
+                    __atomic_sub_fetch(&count, 1, __ATOMIC_RELAXED);
+                    n->next.store(NULL, std::memory_order_relaxed);
+                    return n;
+                }
+            }
+            AddRef();
+            return new node(this);
+        }
+
+        /// Deletes all nodes in the pool.
+        void Drain()
+        {
+            node* n = __atomic_exchange_n(&head, (node*)NULL, __ATOMIC_SEQ_CST);
+            while (n)
+            {
+                node* next = n->next.load(std::memory_order_relaxed);
+                __atomic_sub_fetch(&count, 1, __ATOMIC_RELAXED);
+                Free(n);
+                n = next;
+            }
+        }
+
+        void Put(node* n)
+        {
+            // The node may be drained and the queue destroyed, as soon as
+            // it is pushed.
+            AddRef();
+            if (__atomic_load_n(&closed, __ATOMIC_SEQ_CST) ||
+                    __atomic_load_n(&count, __ATOMIC_RELAXED) >= limit)
+            {
+                Free(n);
+            }
+            else
+            {
+                node* first = __atomic_load_n(&head, __ATOMIC_RELAXED);
+                do {
+                    n->next.store(first, std::memory_order_relaxed);
+                } while (!__atomic_compare_exchange_n(&head, &first, n, false,
+                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+                __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+                // Pairs with Close, either this thread or Close observes
+                // the node.
+                if (__atomic_load_n(&closed, __ATOMIC_SEQ_CST))
+                    Drain();
+            }
+            DropRef();
+        }
+
+        /// The queue is destroyed, nodes are deleted instead of pooled.
+        void Close()
+        {
+            __atomic_store_n(&closed, true, __ATOMIC_SEQ_CST);
+            Drain();
+            DropRef();
+        }
+    };
+
+    /// Closes the pool after the HazardPointerList has been destroyed,
+    /// and has returned the retired nodes.
+    struct pool_closer {
+        node_pool* pool;
+        explicit pool_closer(node_pool* pool):pool(pool) {}
+        ~pool_closer() { pool->Close(); }
+    };
+
+    static void reclaim(node* n)
+    {
+        n->pool->Put(n);
+    }
+
+    pool_closer pool;
+    HazardPointerList<node> hplist;
+    alignas(HazardSlabMemory::k_LINE) std::atomic<node*> head;
+    alignas(HazardSlabMemory::k_LINE) std::atomic<node*> tail;
+    alignas(HazardSlabMemory::k_LINE) eventcount ec;
+    bool closed = false;
+
+    void init()
+    {
+        node* dummy = pool.pool->Alloc();
+        head.store(dummy, std::memory_order_relaxed);
+        tail.store(dummy, std::memory_order_relaxed);
+    }
+
+    void enqueue(node* n)
+    {
+        HazardPointerArray<node, 1> hps(hplist);
+        while (true)
+        {
+            node* t = hps.protect(0, tail);
+            node* next = t->next.load(std::memory_order_acquire);
+            if (t != tail.load(std::memory_order_acquire))
+                continue;
+            if (NULL == next)
+            {
+                // Sequentially consistent, the eventcount requires it.
+                if (t->next.compare_exchange_weak(next, n, std::memory_order_seq_cst,
+                            std::memory_order_relaxed))
+                {
+                    tail.compare_exchange_strong(t, n, std::memory_order_release,
+                            std::memory_order_relaxed);
+                    break;
+                }
+            }
+            else
+            {
+                // Help a lagging enqueue.
+                tail.compare_exchange_strong(t, next, std::memory_order_release,
+                        std::memory_order_relaxed);
+            }
+        }
+        ec.notify();
+    }
+
+ public:
+    /// Default limit on the number of free nodes pooled.
+    static const size_t k_POOL_LIMIT = 4096;
+
+    // Non copyable, non movable.
+    ms_queue(const ms_queue&) = delete;
+    ms_queue& operator=(const ms_queue&) = delete;
+    ms_queue(ms_queue&&) = delete;
+    ms_queue& operator=(ms_queue&&) = delete;
+
+    /// \param pool_limit the maximum number of free nodes pooled.
+    explicit ms_queue(size_t pool_limit = k_POOL_LIMIT)
+        :pool(new node_pool(pool_limit))
+    {
+        init();
+    }
+
+    /// \param pool_limit the maximum number of free nodes pooled.
+    /// \param th_collector the collector thread which collects the
+    /// dequeued nodes.
+    ms_queue(size_t pool_limit, CollectorThread* th_collector)
+        :pool(new node_pool(pool_limit)), hplist(th_collector)
+    {
+        init();
+    }
+
+    /// Destructor, NOT thread safe, items remaining in the queue are
+    /// destroyed.
+    ~ms_queue()
+    {
+        node* n = head.load(std::memory_order_relaxed);
+        node* next = n->next.load(std::memory_order_relaxed);
+        pool.pool->Free(n);
+        for (n = next; n; n = next)
+        {
+            next = n->next.load(std::memory_order_relaxed);
+            n->value()->~T();
+            pool.pool->Free(n);
+        }
+    }
+
+    /// Appends a copy of value.
+    void push(const T& value)
+    {
+        node* n = pool.pool->Alloc();
+        new (n->value()) T(value);
+        enqueue(n);
+    }
+
+    /// Appends value.
+    void push(T&& value)
+    {
+        node* n = pool.pool->Alloc();
+        new (n->value()) T(std::move(value));
+        enqueue(n);
+    }
+
+    /// Removes the item at the front of the queue.
+    /// \param value assigned the item.
+    /// \returns false if the queue was empty.
+    bool try_pop(T& value)
+    {
+        HazardPointerArray<node, 2> hps(hplist);
+        while (true)
+        {
+            node* h = hps.protect(0, head);
+            node* t = tail.load(std::memory_order_acquire);
+            node* next = hps.protect(1, h->next);
+            if (h != head.load(std::memory_order_acquire))
+                continue;
+            if (NULL == next)
+                return false;
+            if (h == t)
+            {
+                tail.compare_exchange_strong(t, next, std::memory_order_release,
+                        std::memory_order_relaxed);
+                continue;
+            }
+            if (head.compare_exchange_strong(h, next, std::memory_order_acq_rel,
+                        std::memory_order_relaxed))
+            {
+                // next is the new dummy node, only the winner accesses
+                // its item, and the hazard pointer keeps it alive.
+                T* item = next->value();
+                value = std::move(*item);
+                item->~T();
+                hps.Clear(0);
+                hplist.Retire(h, &reclaim);
+                return true;
+            }
+        }
+    }
+
+    /// Removes the item at the front of the queue, waiting whilst the
+    /// queue is empty.
+    /// \param value assigned the item.
+    /// \returns false if the queue is empty and has been closed.
+    bool pop(T& value)
+    {
+        while (true)
+        {
+            if (try_pop(value))
+                return true;
+            int key = ec.prepare_wait();
+            if (try_pop(value))
+            {
+                ec.cancel_wait();
+                return true;
+            }
+            if (__atomic_load_n(&closed, __ATOMIC_SEQ_CST))
+            {
+                ec.cancel_wait();
+                return false;
+            }
+            ec.commit_wait(key);
+        }
+    }
+
+    /// Wakes consumers blocked in pop, pop no longer waits once the
+    /// queue is empty. Items may still be pushed.
+    void close()
+    {
+        __atomic_store_n(&closed, true, __ATOMIC_SEQ_CST);
+        ec.notify();
+    }
+
+    /// \returns true if the queue was empty, the result may be stale.
+    bool empty()
+    {
+        HazardPointerArray<node, 1> hps(hplist);
+        node* h = hps.protect(0, head);
+        return NULL == h->next.load(std::memory_order_acquire);
+    }
+};
+
+} // namespace concurrent
+} // namespace benedias
+#endif  // _MS_QUEUE_HPP_INCLUDED
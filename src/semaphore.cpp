@@ -23,6 +23,13 @@ Classes implementing semaphore support.
 #include <stdexcept>
 #include <atomic>
 #include <climits>
+#include <chrono>
+#include <system_error>
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 static const bool futex_throw_on_error = false;
 static const bool futex_assert_on_error = true;
@@ -49,10 +56,12 @@ void binary_semaphore::post()
 {
     static const char* _fn_err_txt = " benedias::binary_semaphore::post";
     int expected=0;
+    // Sequentially consistent, pairs with async_wait_enqueue.
     if (__atomic_compare_exchange_n(&gate, &expected, 1,
-               false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+               false, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE))
     {
         futex_wake(&gate, 1, _fn_err_txt);
+        async_waiters.notify_all();
     }
 }
 
@@ -79,5 +88,202 @@ bool binary_semaphore::try_wait()
     return true;
 }
 
+void binary_semaphore::async_wait_enqueue(async_waiter* waiter)
+{
+    async_waiters.push(waiter);
+    // A post may have happened before the push was visible to it.
+    if (__atomic_load_n(&gate, __ATOMIC_SEQ_CST))
+        async_waiters.notify_all();
+}
+
+// eventfd binary semaphore
+eventfd_binary_semaphore::eventfd_binary_semaphore(bool initial_state)
+{
+    if (initial_state)
+        gate = k_POSTED;
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd < 0)
+        throw std::system_error(errno, std::system_category(),
+                "benedias::eventfd_binary_semaphore eventfd");
+}
+
+eventfd_binary_semaphore::~eventfd_binary_semaphore()
+{
+    static const char* _fn_err_txt = " benedias::eventfd_binary_semaphore::~eventfd_binary_semaphore";
+    if (__atomic_load_n(&waiters, __ATOMIC_ACQUIRE))
+        futex_wake(&gate, INT_MAX, _fn_err_txt);
+    close(efd);
+}
+
+void eventfd_binary_semaphore::post()
+{
+    static const char* _fn_err_txt = " benedias::eventfd_binary_semaphore::post";
+    int prev = __atomic_fetch_or(&gate, (int)k_POSTED, __ATOMIC_SEQ_CST);
+    if (prev & k_POSTED)
+        return;
+    if (__atomic_load_n(&waiters, __ATOMIC_SEQ_CST))
+        futex_wake(&gate, 1, _fn_err_txt);
+    if (prev & k_ARMED)
+    {
+        uint64_t one = 1;
+        // Only fails with EAGAIN if the counter would overflow,
+        // in which case the descriptor is readable anyway.
+        ssize_t rv = write(efd, &one, sizeof(one));
+        (void)rv;
+    }
+}
+
+bool eventfd_binary_semaphore::try_wait()
+{
+    int expected = __atomic_load_n(&gate, __ATOMIC_RELAXED);
+    while (expected & k_POSTED)
+    {
+        if (__atomic_compare_exchange_n(&gate, &expected, expected & ~k_POSTED,
+                   false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return true;
+    }
+    return false;
+}
+
+void eventfd_binary_semaphore::wait()
+{
+    static const char* _fn_err_txt = " benedias::eventfd_binary_semaphore::wait";
+    if (try_wait())
+        return;
+    __atomic_add_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+    int expected;
+    while (!try_wait())
+    {
+        expected = __atomic_load_n(&gate, __ATOMIC_SEQ_CST);
+        if (0 == (expected & k_POSTED))
+            futex_wait(&gate, expected, _fn_err_txt);
+    }
+    __atomic_sub_fetch(&waiters, 1, __ATOMIC_RELAXED);
+}
+
+bool eventfd_binary_semaphore::arm()
+{
+    return __atomic_fetch_or(&gate, (int)k_ARMED, __ATOMIC_SEQ_CST) & k_POSTED;
+}
+
+void eventfd_binary_semaphore::disarm()
+{
+    __atomic_fetch_and(&gate, ~(int)k_ARMED, __ATOMIC_SEQ_CST);
+}
+
+bool eventfd_binary_semaphore::poll_consume()
+{
+    uint64_t count;
+    ssize_t rv = read(efd, &count, sizeof(count));
+    (void)rv;
+    return try_wait();
+}
+
+// Counting semaphore
+semaphore::semaphore(int initial_count):count(initial_count)
+{
+    if (initial_count < 0)
+        throw std::invalid_argument("semaphore initial count is negative");
+}
+
+semaphore::~semaphore()
+{
+    static const char* _fn_err_txt = " benedias::semaphore::~semaphore";
+    if (__atomic_load_n(&waiters, __ATOMIC_ACQUIRE))
+        futex_wake(&count, INT_MAX, _fn_err_txt);
+}
+
+void semaphore::post(unsigned n)
+{
+    static const char* _fn_err_txt = " benedias::semaphore::post";
+    if (n == 0)
+        return;
+    if (n > INT_MAX)
+        throw std::invalid_argument("semaphore post count is too large");
+    // Sequentially consistent, pairs with the increment of waiters in wait.
+    int prev = __atomic_fetch_add(&count, (int)n, __ATOMIC_SEQ_CST);
+    if (prev > INT_MAX - (int)n)
+    {
+        __atomic_fetch_sub(&count, (int)n, __ATOMIC_RELAXED);
+        throw std::overflow_error("semaphore count overflow");
+    }
+    if (__atomic_load_n(&waiters, __ATOMIC_SEQ_CST))
+    {
+        futex_wake(&count,
+                __atomic_load_n(&bulk_waiters, __ATOMIC_RELAXED) ? INT_MAX : (int)n,
+                _fn_err_txt);
+    }
+}
+
+bool semaphore::try_acquire(unsigned n)
+{
+    int expected = __atomic_load_n(&count, __ATOMIC_RELAXED);
+    while (expected >= 0 && (unsigned)expected >= n)
+    {
+        if (__atomic_compare_exchange_n(&count, &expected, expected - (int)n,
+                   false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return true;
+    }
+    return false;
+}
+
+bool semaphore::wait(unsigned n, const struct timespec* deadline)
+{
+    static const char* _fn_err_txt = " benedias::semaphore::wait";
+    if (n > INT_MAX)
+        throw std::invalid_argument("semaphore wait count is too large");
+    if (try_acquire(n))
+        return true;
+
+    bool acquired = false;
+    __atomic_add_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+    if (n > 1)
+        __atomic_add_fetch(&bulk_waiters, 1, __ATOMIC_SEQ_CST);
+    while (!acquired)
+    {
+        int expected = __atomic_load_n(&count, __ATOMIC_SEQ_CST);
+        if (expected >= (int)n)
+        {
+            acquired = __atomic_compare_exchange_n(&count, &expected,
+                    expected - (int)n, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (deadline)
+        {
+            if (futex_op_timedout == futex_wait_until(&count, expected,
+                        deadline, _fn_err_txt))
+            {
+                acquired = try_acquire(n);
+                break;
+            }
+        }
+        else
+        {
+            futex_wait(&count, expected, _fn_err_txt);
+        }
+    }
+    if (n > 1)
+        __atomic_sub_fetch(&bulk_waiters, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&waiters, 1, __ATOMIC_RELAXED);
+    return acquired;
+}
+
+bool semaphore::wait_until(const std::chrono::steady_clock::time_point& deadline,
+        unsigned n)
+{
+    // steady_clock is CLOCK_MONOTONIC, as required by futex_wait_until.
+    auto since_epoch = deadline.time_since_epoch();
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+    struct timespec ts;
+    ts.tv_sec = secs.count();
+    ts.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            since_epoch - secs).count();
+    if (ts.tv_sec < 0)
+    {
+        ts.tv_sec = 0;
+        ts.tv_nsec = 0;
+    }
+    return wait(n, &ts);
+}
 
 } // namespace
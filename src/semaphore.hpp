@@ -20,8 +20,9 @@ Classes implementing semaphore support.
 #ifndef BENEDIAS_SEMAPHORE_INCLUDED
 #define BENEDIAS_SEMAPHORE_INCLUDED
 
-#include <semaphore.h>
-#include <pthread.h>
+#include <time.h>
+#include <chrono>
+#include "bdasync.h"
 
 namespace benedias {
 // semaphore implemented using futex calls.
@@ -38,6 +39,8 @@ class binary_semaphore
     binary_semaphore(binary_semaphore&&) = delete;
 
     int gate=0;
+    // coroutines waiting on this semaphore.
+    async_wait_list async_waiters;
     public:
         binary_semaphore() {}
         binary_semaphore(bool initial_state);
@@ -46,15 +49,80 @@ class binary_semaphore
         void wait();
         bool try_wait();
         int  get_value() { return gate; }
+        // enqueue an asynchronous waiter, notified on post.
+        void async_wait_enqueue(async_waiter* waiter);
+#if defined(__cpp_impl_coroutine)
+        typedef async_acquire_awaiter<binary_semaphore,
+                &binary_semaphore::try_wait,
+                &binary_semaphore::async_wait_enqueue> wait_awaiter;
+
+        // awaitable wait, the coroutine is suspended instead of blocking
+        // the thread, and resumed on executor once the event is consumed.
+        inline wait_awaiter async_wait(
+                async_executor& executor=inline_executor::instance())
+        {
+            return wait_awaiter(*this, executor);
+        }
+#endif
 };
 
+// binary_semaphore variant which can also be waited on by polling a file
+// descriptor (eventfd) with poll, epoll or io_uring, for event loops.
+// post, wait and try_wait behave as for binary_semaphore.
+// The eventfd is only written if a poller has armed the semaphore,
+// so post remains free of syscalls when the consumer is not polling.
+// Poller usage:
+//      if (sem.arm()) -> already posted, call try_wait, do not poll.
+//      add sem.fd() to the poll set, on readable call sem.poll_consume().
+//      sem.disarm() when the poller no longer waits on the fd.
+class eventfd_binary_semaphore
+{
+    // Non copyable
+    eventfd_binary_semaphore& operator=(const eventfd_binary_semaphore&) = delete;
+    eventfd_binary_semaphore(eventfd_binary_semaphore const&) = delete;
+
+    // Non movable
+    eventfd_binary_semaphore& operator=(eventfd_binary_semaphore&&) = delete;
+    eventfd_binary_semaphore(eventfd_binary_semaphore&&) = delete;
+
+    enum {
+        k_POSTED = 1,
+        k_ARMED = 2,
+    };
 
-// Wrapper around UNIX counting semaphore
-// TODO: error handling
+    // k_POSTED and k_ARMED bits, and the futex variable threads wait on.
+    int gate=0;
+    // number of threads waiting on the futex.
+    int waiters=0;
+    int efd;
+    public:
+        eventfd_binary_semaphore(bool initial_state=false);
+        ~eventfd_binary_semaphore();
+        void post();
+        void wait();
+        bool try_wait();
+        int  get_value() { return __atomic_load_n(&gate, __ATOMIC_RELAXED) & k_POSTED; }
+
+        // The file descriptor becomes readable on post, whilst armed.
+        int  fd() const { return efd; }
+        // Start writing the eventfd on post.
+        // returns true if the semaphore is already posted, in which case
+        // the eventfd may not have been written and must not be waited on.
+        bool arm();
+        // Stop writing the eventfd on post.
+        void disarm();
+        // Reset the eventfd readable state, and try_wait.
+        // Called when poll reports the file descriptor readable.
+        bool poll_consume();
+};
+
+// Counting semaphore implemented using futex calls.
+// Permits are acquired and released with atomic operations,
+// the futex is only used when a thread has to wait, and waiters are counted
+// so that post does not make the wake syscall when there are none.
+// Multiple permits can be posted and acquired in a single call.
 class semaphore
 {
-    sem_t   sem;
-
     // Non copyable
     semaphore& operator=(const semaphore&) = delete;
     semaphore(semaphore const&) = delete;
@@ -63,39 +131,55 @@ class semaphore
     semaphore& operator=(semaphore&&) = delete;
     semaphore(semaphore&&) = delete;
 
+    // number of available permits, and the futex variable waiters wait on.
+    int count;
+    // number of threads waiting.
+    int waiters = 0;
+    // number of threads waiting for more than one permit,
+    // if non zero post wakes all waiters, because a waiter for many permits
+    // may not be satisfied, whilst a waiter for fewer could be.
+    int bulk_waiters = 0;
+
+    bool wait(unsigned n, const struct timespec* deadline);
+
     public:
-    semaphore(int count)
-    {
-        sem_init(&sem, 0, count);
-    }
+    explicit semaphore(int initial_count=0);
+    ~semaphore();
 
-    ~semaphore()
-    {
-        sem_destroy(&sem);
-    }
+    // Release n permits, waking up to n waiters.
+    void post(unsigned n=1);
 
-    void post()
+    // Acquire n permits, waiting until they are available.
+    void wait(unsigned n=1)
     {
-        sem_post(&sem);
+        wait(n, NULL);
     }
 
-    void wait()
+    // Acquire n permits, waiting until they are available or the deadline
+    // has passed.
+    // returns true if the permits were acquired.
+    bool wait_until(const std::chrono::steady_clock::time_point& deadline,
+            unsigned n=1);
+
+    template <typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout, unsigned n=1)
     {
-        sem_wait(&sem);
+        return wait_until(std::chrono::steady_clock::now() + timeout, n);
     }
 
-    void try_wait()
+    // Acquire n permits if they are available without waiting.
+    // returns true if the permits were acquired.
+    bool try_acquire(unsigned n=1);
+
+    bool try_wait()
     {
-        sem_trywait(&sem);
+        return try_acquire(1);
     }
 
     int get_value()
     {
-        int v;
-        sem_getvalue(&sem, &v);
-        return v;
+        return __atomic_load_n(&count, __ATOMIC_RELAXED);
     }
-
 };
 
 }// namespace benedias
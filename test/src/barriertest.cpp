@@ -0,0 +1,96 @@
+/*
+
+Copyright (C) 2018  Blaise Dias
+
+This file is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This file is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this file.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+#include <assert.h>
+#include "bdbarrier.h"
+
+using benedias::barrier;
+using benedias::latch;
+
+struct phase_args {
+    unsigned phases_seen = 0;
+};
+
+static void barrier_worker(barrier& b, const volatile unsigned& completed,
+        unsigned nphases, phase_args& args)
+{
+    for (unsigned ix = 0; ix < nphases; ++ix)
+    {
+        // every participant must observe the same number of completed phases.
+        assert(completed == ix);
+        b.arrive_and_wait();
+        ++args.phases_seen;
+    }
+}
+
+static void barrier_test(unsigned nthreads, unsigned nphases)
+{
+    std::cout << "Barrier Test " << nthreads << " threads." << std::endl;
+    volatile unsigned completed = 0;
+    barrier b(nthreads, [&completed]{ completed = completed + 1; });
+    std::vector<phase_args> args(nthreads);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &arg : args)
+        workers.emplace_back(std::thread(barrier_worker, std::ref(b),
+                    std::cref(completed), nphases, std::ref(arg)));
+    for (auto &th : workers)
+        th.join();
+    auto end = std::chrono::high_resolution_clock::now();
+
+    assert(completed == nphases);
+    for (auto &arg : args)
+        assert(arg.phases_seen == nphases);
+    std::chrono::duration<double, std::micro> elapsed = end-start;
+    std::cout << " Phase " << (elapsed.count() / nphases) << " us\n";
+}
+
+void latch_test()
+{
+    std::cout << "Latch Test." << std::endl;
+    const unsigned nthreads = 16;
+    latch start(1);
+    latch done(nthreads);
+    std::vector<std::thread> workers;
+    for (unsigned ix = 0; ix < nthreads; ++ix)
+        workers.emplace_back(std::thread([&]{ start.wait(); done.count_down(); }));
+    bool ready = start.try_wait();
+    assert(!ready);
+    ready = done.try_wait();
+    assert(!ready);
+    start.count_down();
+    done.wait();
+    ready = done.try_wait();
+    assert(ready);
+    for (auto &th : workers)
+        th.join();
+}
+
+void barrier_test()
+{
+    // single counter
+    barrier_test(8, 10000);
+    // combining tree
+    barrier_test(64, 2000);
+    barrier_test(67, 2000);
+}
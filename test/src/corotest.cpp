@@ -0,0 +1,110 @@
+/*
+
+Copyright (C) 2018  Blaise Dias
+
+This file is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This file is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this file.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <coroutine>
+
+#include <assert.h>
+#include "bdrwlock.h"
+#include "semaphore.hpp"
+
+using benedias::futex_rw_control;
+using benedias::binary_semaphore;
+using namespace std::chrono_literals;
+
+// Minimal eagerly started, self destroying coroutine type.
+struct detached_task {
+    struct promise_type {
+        detached_task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static futex_rw_control rw;
+static binary_semaphore bs;
+static int readers_done = 0;
+static int waits_done = 0;
+
+static detached_task co_reader()
+{
+    co_await rw.async_read_lock();
+    ++readers_done;
+    rw.read_unlock();
+}
+
+static detached_task co_waiter()
+{
+    co_await bs.async_wait();
+    ++waits_done;
+}
+
+void coro_rwlock_test()
+{
+    std::cout << "Coroutine Read Lock Test." << std::endl;
+    // Uncontended: completes without suspending.
+    co_reader();
+    assert(readers_done == 1);
+
+    // Contended: readers are suspended whilst a writer holds the lock,
+    // and resumed when the lock is released.
+    rw.write_lock();
+    for (int i = 0; i < 10; ++i)
+        co_reader();
+    assert(readers_done == 1);
+    rw.write_unlock();
+    assert(readers_done == 11);
+
+    // Release from another thread.
+    rw.write_lock();
+    co_reader();
+    std::thread th([]{ std::this_thread::sleep_for(100ms); rw.write_unlock(); });
+    th.join();
+    assert(readers_done == 12);
+}
+
+void coro_bs_test()
+{
+    std::cout << "Coroutine Binary Semaphore Test." << std::endl;
+    bs.post();
+    co_waiter();
+    assert(waits_done == 1);
+
+    co_waiter();
+    co_waiter();
+    assert(waits_done == 1);
+    // Each post is consumed by exactly one waiter.
+    bs.post();
+    assert(waits_done == 2);
+    std::thread th([]{ bs.post(); });
+    th.join();
+    assert(waits_done == 3);
+    assert(bs.get_value() == 0);
+}
+
+int main(int argc, char* argv[])
+{
+    coro_rwlock_test();
+    std::cout << "--------------------" << std::endl;
+    coro_bs_test();
+    std::cout << "--------------------" << std::endl;
+    std::cout << "All Done. " << std::endl;
+}
@@ -0,0 +1,222 @@
+/*
+
+Copyright (C) 2016  Blaise Dias
+
+This file is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This file is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this file.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <assert.h>
+#include "HazardPointer.hpp"
+#include "EpochDomain.hpp"
+
+using benedias::concurrent::EpochDomain;
+using benedias::concurrent::EpochGuard;
+using benedias::concurrent::HazardFence;
+using benedias::concurrent::HazardPointer;
+using benedias::concurrent::HazardPointerList;
+
+struct Item {
+    static const uint64_t k_MAGIC = 0x1234567887654321ULL;
+    uint64_t magic = k_MAGIC;
+    uint64_t value;
+    explicit Item(uint64_t v):value(v){}
+    ~Item(){ magic = 0; }
+};
+
+static std::atomic<int> reclaimed(0);
+
+static void reclaim_item(Item* item)
+{
+    delete item;
+    reclaimed.fetch_add(1);
+}
+
+// Objects are only deleted once every critical section which may hold
+// a reference has exited.
+static void epoch_test()
+{
+    std::cout << "Epoch Domain Test." << std::endl;
+    EpochDomain<Item> domain;
+    reclaimed = 0;
+    {
+        // Critical sections nest.
+        EpochGuard<Item> outer(domain);
+        EpochGuard<Item> inner(domain);
+        assert(domain.InCriticalSection());
+    }
+    assert(!domain.InCriticalSection());
+
+    std::atomic<int> stage(0);
+    std::thread reader([&]{
+        domain.Enter();
+        stage = 1;
+        while (stage.load() != 2)
+            std::this_thread::yield();
+        domain.Exit();
+        stage = 3;
+    });
+    while (stage.load() != 1)
+        std::this_thread::yield();
+
+    domain.Retire(new Item(1), reclaim_item);
+    domain.FlushRetired();
+    for (int x = 0; x < 4; x++)
+    {
+        bool collected = domain.Collect();
+        assert(!collected);
+    }
+    assert(reclaimed.load() == 0);
+    assert(domain.RetiredCount() == 1);
+
+    stage = 2;
+    while (stage.load() != 3)
+        std::this_thread::yield();
+    bool collected = domain.Collect();
+    assert(collected);
+    assert(reclaimed.load() == 1);
+    reader.join();
+
+    // Retirement from within a critical section.
+    {
+        EpochGuard<Item> guard(domain);
+        domain.Retire(new Item(2), reclaim_item);
+        domain.FlushRetired();
+    }
+    domain.Collect();
+    assert(domain.RetiredCount() == 0);
+    assert(reclaimed.load() == 2);
+}
+
+// The same workload for both schemes: readers repeatedly perform short
+// operations reading k_DEPTH items from a table of slots, whilst a writer
+// replaces items and retires them.
+static const unsigned k_SLOTS = 64;
+static const unsigned k_DEPTH = 4;
+
+struct Workload {
+    std::atomic<Item*> slots[k_SLOTS];
+    unsigned nreaders;
+    unsigned reads;
+    unsigned writes;
+
+    Workload(unsigned nreaders, unsigned reads, unsigned writes)
+        :nreaders(nreaders), reads(reads), writes(writes)
+    {
+        for (unsigned ix = 0; ix < k_SLOTS; ++ix)
+            slots[ix].store(new Item(ix));
+    }
+
+    ~Workload()
+    {
+        for (unsigned ix = 0; ix < k_SLOTS; ++ix)
+            delete slots[ix].load();
+    }
+
+    template <typename READ, typename RETIRE> double Run(READ read, RETIRE retire)
+    {
+        std::vector<std::thread> threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (unsigned th = 0; th < nreaders; ++th)
+        {
+            threads.emplace_back([this, th, &read]{ read(slots, th, reads); });
+        }
+        threads.emplace_back([this, &retire]{
+            for (unsigned ix = 0; ix < writes; ++ix)
+            {
+                Item* old = slots[ix % k_SLOTS].exchange(new Item(ix));
+                retire(old);
+            }
+        });
+        for (auto& th : threads)
+            th.join();
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::nano> elapsed = end - start;
+        return elapsed.count() / ((double)nreaders * reads);
+    }
+};
+
+static void bench(unsigned nreaders, unsigned reads, unsigned writes)
+{
+    std::cout << "Benchmark " << nreaders << " readers, " << reads
+        << " operations of " << k_DEPTH << " reads each, " << writes
+        << " writes, " << (HazardFence::IsAsymmetric() ? "asymmetric" : "symmetric")
+        << " fences." << std::endl;
+    {
+        HazardPointerList<Item> hplist;
+        Workload work(nreaders, reads, writes);
+        reclaimed = 0;
+        double ns = work.Run(
+            [&hplist](std::atomic<Item*>* slots, unsigned th, unsigned reads) {
+                HazardPointer<Item> hp(hplist);
+                uint64_t sum = 0;
+                for (unsigned ix = 0; ix < reads; ++ix)
+                {
+                    for (unsigned depth = 0; depth < k_DEPTH; ++depth)
+                    {
+                        Item* item = hp.protect(slots[(ix + th + depth) % k_SLOTS]);
+                        assert(item->magic == Item::k_MAGIC);
+                        sum += item->value;
+                    }
+                }
+                return sum;
+            },
+            [&hplist](Item* item){ hplist.Retire(item, reclaim_item); });
+        hplist.FlushRetired();
+        hplist.Collect(true);
+        assert(hplist.RetiredCount() == 0);
+        assert(reclaimed.load() == (int)writes);
+        std::cout << " HazardPointerList " << ns << " ns per operation" << std::endl;
+    }
+    {
+        EpochDomain<Item> domain;
+        Workload work(nreaders, reads, writes);
+        reclaimed = 0;
+        double ns = work.Run(
+            [&domain](std::atomic<Item*>* slots, unsigned th, unsigned reads) {
+                uint64_t sum = 0;
+                for (unsigned ix = 0; ix < reads; ++ix)
+                {
+                    EpochGuard<Item> guard(domain);
+                    for (unsigned depth = 0; depth < k_DEPTH; ++depth)
+                    {
+                        Item* item = slots[(ix + th + depth) % k_SLOTS].load(
+                                std::memory_order_acquire);
+                        assert(item->magic == Item::k_MAGIC);
+                        sum += item->value;
+                    }
+                }
+                return sum;
+            },
+            [&domain](Item* item){ domain.Retire(item, reclaim_item); });
+        domain.FlushRetired();
+        while (!domain.Collect())
+            std::this_thread::yield();
+        assert(reclaimed.load() == (int)writes);
+        std::cout << " EpochDomain       " << ns << " ns per operation" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    epoch_test();
+    std::cout << "--------------------" << std::endl;
+    bench(4, 200000, 20000);
+    std::cout << "--------------------" << std::endl;
+    std::cout << "All Done. " << std::endl;
+}
@@ -20,8 +20,12 @@ along with HazardPointer .  If not, see <http://www.gnu.org/licenses/>. *
 #include <unistd.h>
 #include <cstdio>
 #include <iostream>
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
 #include "HazardPointer.hpp"
+#include "hp_snapshot.hpp"
 
 namespace benedias {
     namespace concurrent {
@@ -205,6 +209,936 @@ void t2()
     }
 }
 
+// Collect only scans once the retired objects reach the threshold.
+void t3()
+{
+    HazardPointerList<std::string>   hplist;
+    hplist.SetScanThreshold(0, 4);
+    for (int x = 0; x < 3; x++)
+    {
+        std::string* str = new std::string("retired");
+        HazardPointer<std::string> hp(hplist);
+        hp.Acquire(&str);
+        hp.Delete();
+    }
+    // Retired objects do not hold hazard pointer nodes,
+    // a single slab suffices.
+    assert(hplist.NodeCount() == HazardPointerSlab<std::string>::k_NODES);
+    hplist.FlushRetired();
+    assert(hplist.RetiredCount() == 3);
+    bool collected = hplist.Collect();
+    assert(collected);
+    assert(hplist.ScanStats().scans == 0);
+
+    std::string* str = new std::string("protected");
+    HazardPointer<std::string> hp(hplist);
+    hp.Acquire(&str);
+    {
+        std::string* str2 = str;
+        HazardPointer<std::string> hp2(hplist);
+        hp2.Acquire(&str2);
+        hp2.Delete();
+    }
+    assert(hplist.NodeCount() == HazardPointerSlab<std::string>::k_NODES);
+    // Without a collector thread, the retiring thread collects once
+    // the threshold is reached.
+    hplist.FlushRetired();
+    HazardScanStats stats = hplist.ScanStats();
+    assert(stats.scans == 1);
+    assert(stats.retired_scanned == 4);
+    assert(stats.reclaimed == 3);
+    assert(hplist.RetiredCount() == 1);
+}
+
+// Bulk retirement, only unprotected objects are deleted.
+void t4()
+{
+    HazardPointerList<std::string>   hplist;
+    hplist.SetScanThreshold(2, 1024);
+    std::vector<std::string*> objs;
+    for (int x = 0; x < 1024; x++)
+        objs.push_back(new std::string("retired"));
+    std::string* str = objs[500];
+    HazardPointer<std::string> hp(hplist);
+    hp.Acquire(&str);
+
+    hplist.Retire(objs.data(), 1023);
+    assert(hplist.ScanStats().scans == 0);
+    // The last object fills the batch, reaching the threshold.
+    hplist.Retire(objs[1023]);
+    HazardScanStats stats = hplist.ScanStats();
+    assert(stats.scans == 1);
+    assert(stats.retired_scanned == 1024);
+    assert(stats.reclaimed == 1023);
+    assert(hplist.RetiredCount() == 1);
+
+    hp.Release();
+    hplist.Collect(true);
+    assert(hplist.RetiredCount() == 0);
+}
+
+// Idle slabs are deleted, and the node limit is enforced.
+void t5()
+{
+    HazardPointerList<std::string>   hplist;
+    const unsigned nhps = 8 * HazardPointerSlab<std::string>::k_NODES;
+    {
+        std::vector<HazardPointer<std::string>> hps;
+        hps.reserve(nhps);
+        for (unsigned x = 0; x < nhps; x++)
+            hps.emplace_back(hplist);
+    }
+    assert(hplist.NodeCount() >= nhps);
+    size_t allocated = hplist.NodeCount();
+    // Nodes on the free list are marked idle, and then their slabs
+    // are deleted. Slabs of nodes in the thread cache are retained.
+    size_t deleted = hplist.Shrink();
+    assert(deleted == 0);
+    deleted = hplist.Shrink();
+    assert(deleted > 0);
+    assert(hplist.NodeCount() < allocated);
+    assert(hplist.NodeCount() > 0);
+    size_t count = hplist.NodeCount();
+    {
+        HazardPointer<std::string> hp(hplist);
+    }
+    assert(hplist.NodeCount() == count);
+
+    HazardPointerList<std::string>   limited;
+    limited.SetNodeLimits(0, 2, HazardNodePolicy::k_FAIL);
+    std::string* str = strings[1];
+    {
+        HazardPointer<std::string> hp1(limited);
+        HazardPointer<std::string> hp2(limited);
+        HazardPointer<std::string> hp3(limited);
+        bool ok = hp1.Acquire(&str);
+        assert(ok);
+        ok = hp2.Acquire(&str);
+        assert(ok);
+        ok = hp3.Acquire(&str);
+        assert(!ok);
+        assert(limited.NodeCount() == 2);
+    }
+
+    limited.SetNodeLimits(0, 2, HazardNodePolicy::k_BLOCK);
+    std::thread* th;
+    std::atomic<bool> acquired(false);
+    {
+        HazardPointer<std::string> hp1(limited);
+        HazardPointer<std::string> hp2(limited);
+        th = new std::thread([&limited, &acquired]{
+                std::string* str = strings[1];
+                HazardPointer<std::string> hp3(limited);
+                bool ok = hp3.Acquire(&str);
+                assert(ok);
+                acquired = ok;
+                });
+        // Release the nodes once the thread is blocked on the limit.
+        while (limited.NodeWaiters() == 0)
+            std::this_thread::yield();
+        assert(!acquired.load());
+    }
+    th->join();
+    delete th;
+    assert(acquired.load());
+    assert(limited.NodeCount() == 2);
+}
+
+struct Counted: public hazard_pointer_obj_base<Counted> {
+    static int deleted;
+    int value;
+    explicit Counted(int v):value(v){}
+    ~Counted(){ ++deleted; }
+};
+int Counted::deleted = 0;
+
+struct CustomDeleted;
+struct CountingDeleter {
+    static int invoked;
+    void operator()(CustomDeleted* obj);
+};
+int CountingDeleter::invoked = 0;
+
+struct CustomDeleted: public hazard_pointer_obj_base<CustomDeleted, CountingDeleter> {
+};
+
+void CountingDeleter::operator()(CustomDeleted* obj)
+{
+    ++invoked;
+    delete obj;
+}
+
+// Standard style API, objects of different types share the default domain.
+void t6()
+{
+    hazard_pointer_domain& domain = hazard_pointer_default_domain();
+    std::atomic<Counted*> src(new Counted(1));
+    hazard_pointer hp = make_hazard_pointer();
+    assert(!hp.empty());
+    Counted* ptr = hp.protect(src);
+    assert(ptr->value == 1);
+
+    // A stale pointer is not protected.
+    Counted* stale = new Counted(2);
+    Counted* expected = stale;
+    hazard_pointer hp2 = make_hazard_pointer();
+    bool ok = hp2.try_protect(expected, src);
+    assert(!ok);
+    assert(expected == ptr);
+    ok = hp2.try_protect(expected, src);
+    assert(ok);
+    stale->retire();
+
+    src.store(new Counted(3));
+    ptr->retire();
+    domain.FlushRetired();
+    domain.Collect(true);
+    // Only the protected object remains.
+    assert(Counted::deleted == 1);
+    hp.reset_protection();
+    hp2.reset_protection();
+    domain.Collect(true);
+    assert(Counted::deleted == 2);
+
+    std::atomic<CustomDeleted*> csrc(new CustomDeleted());
+    hazard_pointer hp3 = make_hazard_pointer();
+    hp3.protect(csrc)->retire();
+    hp.protect(src)->retire();
+    domain.FlushRetired();
+    domain.Collect(true);
+    assert(CountingDeleter::invoked == 0);
+    assert(Counted::deleted == 2);
+    hp3 = hazard_pointer();
+    hp = hazard_pointer();
+    assert(hp.empty());
+    domain.Collect(true);
+    assert(CountingDeleter::invoked == 1);
+    assert(Counted::deleted == 3);
+
+    // retire cannot fail, at the garbage limit with k_FAIL the object is
+    // retired regardless.
+    std::atomic<Counted*> lsrc(new Counted(4));
+    hp = make_hazard_pointer();
+    hp.protect(lsrc)->retire();
+    domain.FlushRetired();
+    domain.SetGarbageLimits(1, 0, HazardGarbagePolicy::k_FAIL);
+    (new Counted(5))->retire();
+    domain.FlushRetired();
+    assert(domain.RetiredCount() == 2);
+    hp.reset_protection();
+    domain.Collect(true);
+    assert(Counted::deleted == 5);
+    domain.SetGarbageLimits(0, 0, HazardGarbagePolicy::k_HELP);
+
+    // Protection with the typed HazardPointer.
+    HazardPointerList<std::string>   hplist;
+    std::atomic<std::string*> ssrc(strings[2]);
+    HazardPointer<std::string> shp(hplist);
+    std::string* sptr = shp.protect(ssrc);
+    assert(sptr == strings[2]);
+    assert(shp() == strings[2]);
+}
+
+// Multiple slots acquired and released together, hand-over-hand.
+void t7()
+{
+    HazardPointerList<std::string>   hplist;
+    std::atomic<std::string*> links[4];
+    for (int x = 0; x < 4; x++)
+        links[x].store(strings[x]);
+    {
+        HazardPointerArray<std::string, 2> hpa(hplist);
+        assert(hpa.IsBound());
+        assert(hplist.NodeCount() == HazardPointerSlab<std::string>::k_NODES);
+        std::string* ptr = hpa.protect(0, links[0]);
+        assert(ptr == strings[0]);
+        for (int x = 1; x < 4; x++)
+        {
+            ptr = hpa.protect(1, links[x]);
+            assert(ptr == strings[x]);
+            // The current object becomes the previous object.
+            hpa.swap(0, 1);
+            assert(hpa[0] == strings[x]);
+            assert(hpa[1] == strings[x - 1]);
+        }
+        std::string* retired = new std::string("retired");
+        std::atomic<std::string*> src(retired);
+        hpa.protect(1, src);
+        hpa.Delete(1);
+        assert(hpa[1] == NULL);
+        hplist.FlushRetired();
+    }
+    // The nodes are reused.
+    {
+        HazardPointerArray<std::string, 2> hpa(hplist);
+        assert(hplist.NodeCount() == HazardPointerSlab<std::string>::k_NODES);
+    }
+
+    // A moved HazardPointer takes over the protection.
+    std::string* str = strings[0];
+    HazardPointer<std::string> hp1(hplist);
+    hp1.Acquire(&str);
+    HazardPointer<std::string> hp2(std::move(hp1));
+    assert(hp2() == strings[0]);
+    assert(hp1() == NULL);
+}
+
+// Protected objects are retained, whether few pointers are protected
+// and matched by comparison, or many and matched by hash set lookup.
+void t8()
+{
+    uintptr_t values[9] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    for (size_t count = 0; count <= 9; count++)
+    {
+        for (uintptr_t v = 1; v <= 10; v++)
+            assert(HazardMatch::Contains(values, count, v) == (v <= count));
+    }
+
+    for (unsigned nprotect : {8u, 2 * (unsigned)HazardMatch::k_LINEAR_MAX})
+    {
+        HazardPointerList<std::string>   hplist;
+        std::vector<std::string*> objs;
+        std::vector<HazardPointer<std::string>> hps;
+        hps.reserve(nprotect);
+        for (unsigned x = 0; x < 2 * nprotect; x++)
+            objs.push_back(new std::string("retired"));
+        for (unsigned x = 0; x < nprotect; x++)
+        {
+            hps.emplace_back(hplist);
+            hps.back().Acquire(&objs[2 * x]);
+        }
+        hplist.Retire(objs.data(), objs.size());
+        hplist.FlushRetired();
+        hplist.Collect(true);
+        assert(hplist.RetiredCount() == nprotect);
+        hps.clear();
+        hplist.Collect(true);
+        assert(hplist.RetiredCount() == 0);
+    }
+}
+
+static std::atomic<int> t9_reclaimed(0);
+
+static void t9_reclaim(std::string* str)
+{
+    delete str;
+    t9_reclaimed.fetch_add(1);
+}
+
+// Collect does not block, threads retiring objects collect concurrently
+// with each other and with Shrink.
+void t9()
+{
+    HazardPointerList<std::string>   hplist;
+    hplist.SetScanThreshold(0, 64);
+    const int nthreads = 4;
+    const int nobjs = 4096;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; t++)
+    {
+        threads.emplace_back([&hplist]{
+            for (int x = 0; x < nobjs; x++)
+            {
+                std::string* str = new std::string("retired");
+                HazardPointer<std::string> hp(hplist);
+                hp.Acquire(&str);
+                hp.Release();
+                hplist.Retire(str, t9_reclaim);
+                if (x % 256 == 0)
+                {
+                    hplist.Collect(true);
+                    hplist.Shrink();
+                }
+            }
+            hplist.FlushRetired();
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    hplist.Collect(true);
+    assert(hplist.RetiredCount() == 0);
+    assert(t9_reclaimed.load() == nthreads * nobjs);
+}
+
+struct Shared : public HazardRefCounted {
+    static std::atomic<int> deleted;
+    int value;
+    explicit Shared(int v):value(v){}
+    ~Shared(){ deleted.fetch_add(1); }
+};
+std::atomic<int> Shared::deleted(0);
+
+// A promoted reference keeps a retired object alive after the hazard
+// pointer has been cleared, the object is deleted by the first Collect
+// after the last reference is dropped.
+void t10()
+{
+    HazardPointerList<Shared>   hplist;
+    std::atomic<Shared*> src(new Shared(10));
+    HazardRef<Shared> ref;
+    {
+        HazardPointer<Shared> hp(hplist);
+        Shared* obj = hp.protect(src);
+        ref = hp.promote();
+        assert(hp() == NULL);
+        assert(ref.get() == obj);
+        assert(obj->RefCount() == 1);
+    }
+    HazardRef<Shared> copy(ref);
+    assert(ref->RefCount() == 2);
+
+    Shared* old = src.exchange(NULL);
+    hplist.Retire(old);
+    hplist.FlushRetired();
+    hplist.Collect(true);
+    assert(Shared::deleted.load() == 0);
+    assert(hplist.RetiredCount() == 1);
+    assert(copy->value == 10);
+
+    ref.reset();
+    hplist.Collect(true);
+    assert(Shared::deleted.load() == 0);
+    copy.reset();
+    hplist.Collect(true);
+    assert(Shared::deleted.load() == 1);
+    assert(hplist.RetiredCount() == 0);
+
+    // Objects which are not promoted are deleted as before.
+    hplist.Retire(new Shared(11));
+    hplist.FlushRetired();
+    hplist.Collect(true);
+    assert(Shared::deleted.load() == 2);
+}
+
+// The collector thread only scans clients which signalled, and retries an
+// incomplete collection after the policy retry interval, without a signal.
+void t11()
+{
+    CollectorPolicy policy;
+    policy.min_retry = std::chrono::milliseconds(1);
+    policy.max_retry = std::chrono::milliseconds(8);
+    CollectorThread thCollector(policy);
+    assert(thCollector.Policy().max_retry == policy.max_retry);
+    HazardPointerList<std::string>   idle(&thCollector);
+    HazardPointerList<std::string>   hplist(&thCollector);
+    hplist.SetScanThreshold(0, 4);
+
+    // Protected objects at the threshold, the collection is incomplete.
+    std::vector<HazardPointer<std::string>> hps;
+    for (int x = 0; x < 4; x++)
+    {
+        std::string* str = new std::string("protected");
+        hps.emplace_back(hplist);
+        hps.back().Acquire(&str);
+        hplist.Retire(str);
+    }
+    hplist.FlushRetired();
+    while (hplist.ScanStats().scans == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    assert(hplist.RetiredCount() == 4);
+
+    for (auto& hp : hps)
+        hp.Release();
+    for (int x = 0; x < 1000 && hplist.RetiredCount() != 0; x++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    assert(hplist.RetiredCount() == 0);
+    assert(hplist.ScanStats().scans >= 2);
+    assert(idle.ScanStats().scans == 0);
+}
+
+static std::atomic<bool> t12_hold(false);
+static std::atomic<bool> t12_holding(false);
+static std::atomic<int> t12_reclaimed(0);
+
+// Keeps the collecting thread busy until t12_hold is cleared.
+static void t12_hold_reclaim(std::string* str)
+{
+    t12_holding = true;
+    while (t12_hold.load())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    delete str;
+}
+
+static void t12_reclaim(std::string* str)
+{
+    delete str;
+    ++t12_reclaimed;
+}
+
+// Clients are sharded across the threads of a pool, and are registered and
+// deregistered whilst collections run.
+void t12()
+{
+    CollectorPolicy policy;
+    policy.steal_backlog = 16;
+    policy.sched_idle = true;
+    CollectorPool pool(2, policy, std::vector<int>{0});
+    assert(pool.Size() == 2);
+    const int nlists = 8;
+    const int nobjs = 64;
+    for (int round = 0; round < 4; round++)
+    {
+        std::vector<HazardPointerList<std::string>*> lists;
+        for (int ix = 0; ix < nlists; ix++)
+        {
+            CollectorThread* thread = pool.Assign();
+            lists.push_back(new HazardPointerList<std::string>(thread));
+            lists.back()->SetScanThreshold(0, 16);
+            if (ix == 0)
+            {
+                CollectorThread* next = pool.Assign();
+                assert(next != thread);
+            }
+        }
+        std::vector<std::thread> threads;
+        for (int th = 0; th < 4; th++)
+        {
+            threads.emplace_back([&lists]{
+                for (auto hplist : lists)
+                {
+                    for (int x = 0; x < nobjs; x++)
+                        hplist->Retire(new std::string("retired"));
+                }
+            });
+        }
+        for (auto& th : threads)
+            th.join();
+        for (auto hplist : lists)
+        {
+            for (int x = 0; x < 1000 && hplist->RetiredCount() != 0; x++)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            assert(hplist->RetiredCount() == 0);
+        }
+        for (auto hplist : lists)
+        {
+            hplist->Retire(new std::string("retired"));
+            delete hplist;
+        }
+    }
+
+    // A backlog on a busy thread is stolen by the idle thread.
+    CollectorPolicy steal_policy;
+    steal_policy.steal_backlog = 16;
+    CollectorPool steal_pool(2, steal_policy);
+    CollectorThread* owner = &steal_pool.Thread(0);
+    HazardPointerList<std::string> held(owner);
+    HazardPointerList<std::string> backlog(owner);
+    held.SetScanThreshold(0, 1);
+    backlog.SetScanThreshold(0, 16);
+    t12_hold = true;
+    held.Retire(new std::string("held"), t12_hold_reclaim);
+    held.FlushRetired();
+    while (!t12_holding.load())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    // The owner is blocked in the collection of held, so only the other
+    // thread can collect backlog.
+    for (int x = 0; x < 32; x++)
+        backlog.Retire(new std::string("retired"), t12_reclaim);
+    backlog.FlushRetired();
+    for (int x = 0; x < 10000 && t12_reclaimed.load() != 32; x++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    assert(t12_reclaimed.load() == 32);
+    assert(t12_holding.load() && t12_hold.load());
+    assert(backlog.RetiredCount() == 0);
+    t12_hold = false;
+
+    // Pinned backlogs are stolen at most once per round of the thief,
+    // and retried after the retry interval of the owner.
+    CollectorPolicy pinned_policy;
+    pinned_policy.steal_backlog = 16;
+    pinned_policy.min_retry = std::chrono::milliseconds(1);
+    pinned_policy.max_retry = std::chrono::milliseconds(8);
+    CollectorPool pinned_pool(2, pinned_policy);
+    std::vector<HazardPointerList<std::string>*> pinned;
+    std::vector<HazardPointer<std::string>> hps;
+    hps.reserve(2 * 32);
+    for (unsigned ix = 0; ix < pinned_pool.Size(); ix++)
+    {
+        pinned.push_back(new HazardPointerList<std::string>(&pinned_pool.Thread(ix)));
+        pinned.back()->SetScanThreshold(0, 16);
+        for (int x = 0; x < 32; x++)
+        {
+            std::string* str = new std::string("pinned");
+            hps.emplace_back(*pinned.back());
+            hps.back().Acquire(&str);
+            pinned.back()->Retire(str);
+        }
+        pinned.back()->FlushRetired();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    for (auto hplist : pinned)
+    {
+        assert(hplist->RetiredCount() == 32);
+        // About 2 scans per retry interval, rather than a scan per steal.
+        assert(hplist->ScanStats().scans >= 1);
+        assert(hplist->ScanStats().scans < 1000);
+    }
+#if     defined(HAZARD_POINTER_STATS)
+    uint64_t steals = 0;
+    for (unsigned ix = 0; ix < pinned_pool.Size(); ix++)
+        steals += pinned_pool.Thread(ix).Snapshot().steals;
+    assert(steals < 1000);
+#endif
+    hps.clear();
+    for (auto hplist : pinned)
+    {
+        for (int x = 0; x < 1000 && hplist->RetiredCount() != 0; x++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        assert(hplist->RetiredCount() == 0);
+        delete hplist;
+    }
+}
+
+static std::atomic<int> t13_reclaimed(0);
+
+static void t13_reclaim(std::string* str)
+{
+    delete str;
+    t13_reclaimed.fetch_add(1);
+}
+
+static HazardPointerList<std::string>* t13_others[4];
+static unsigned t13_next_other = 0;
+
+// Retires to another list, so the thread cache of the collecting list
+// is evicted.
+static void t13_retire_other(std::string* str)
+{
+    t13_reclaim(str);
+    t13_others[t13_next_other++ % 4]->Retire(new std::string("other"));
+}
+
+// Inline collection, and the garbage limit policies.
+void t13()
+{
+    HazardPointerList<std::string>   hplist;
+    hplist.SetScanThreshold(0, 1024);
+    hplist.SetInlineCollect(8);
+    std::vector<HazardPointer<std::string>> hps;
+    std::vector<std::string*> protected_strs;
+    for (int x = 0; x < 4; x++)
+    {
+        std::string* str = new std::string("protected");
+        hps.emplace_back(hplist);
+        hps.back().Acquire(&str);
+        protected_strs.push_back(str);
+    }
+    // The thread scans its own batch once it holds 8 objects,
+    // regardless of the scan threshold.
+    for (int x = 0; x < 7; x++)
+        hplist.Retire(new std::string("retired"), t13_reclaim);
+    assert(t13_reclaimed.load() == 0);
+    hplist.Retire(new std::string("retired"), t13_reclaim);
+    assert(t13_reclaimed.load() == 8);
+    assert(hplist.RetiredCount() == 0);
+    for (auto str : protected_strs)
+        hplist.Retire(str, t13_reclaim);
+    hplist.FlushRetired();
+    assert(hplist.RetiredCount() == 4);
+    assert(hplist.RetiredBytes() == 4 * sizeof(std::string));
+
+    // At the limit, objects are not retired. The thread collects once,
+    // and not again until it has retired a batch worth at the limit.
+    hplist.SetGarbageLimits(4, 0, HazardGarbagePolicy::k_FAIL);
+    uint64_t scans = hplist.ScanStats().scans;
+    std::string* str = new std::string("retired");
+    bool ok = hplist.Retire(str, t13_reclaim);
+    assert(!ok);
+    assert(hplist.ScanStats().scans == scans + 1);
+    hplist.SetGarbageLimits(0, 4 * sizeof(std::string), HazardGarbagePolicy::k_FAIL);
+    ok = hplist.Retire(str, t13_reclaim);
+    assert(!ok);
+    assert(hplist.ScanStats().scans == scans + 1);
+    // Retired regardless, after collecting.
+    hplist.SetGarbageLimits(4, 0, HazardGarbagePolicy::k_HELP);
+    ok = hplist.Retire(str, t13_reclaim);
+    assert(ok);
+    hplist.FlushRetired();
+    assert(hplist.RetiredCount() == 4);
+
+    // A bulk retire is checked in full against the limit.
+    hplist.SetGarbageLimits(6, 0, HazardGarbagePolicy::k_FAIL);
+    std::string* strs[3];
+    for (auto& s : strs)
+        s = new std::string("retired");
+    ok = hplist.Retire(strs, 3, t13_reclaim);
+    assert(!ok);
+    ok = hplist.Retire(strs, 2, t13_reclaim);
+    assert(ok);
+    delete strs[2];
+    hplist.FlushRetired();
+    assert(hplist.RetiredCount() == 4);
+
+    // Blocked until the hazard pointers are released.
+    hplist.SetGarbageLimits(4, 0, HazardGarbagePolicy::k_BLOCK);
+    std::atomic<bool> retired(false);
+    std::thread retirer([&hplist, &retired]{
+        hplist.Retire(new std::string("retired"), t13_reclaim);
+        retired = true;
+        hplist.FlushRetired();
+    });
+    while (hplist.GarbageWaiters() == 0)
+        std::this_thread::yield();
+    assert(!retired.load());
+    for (auto& hp : hps)
+        hp.Release();
+    retirer.join();
+    assert(retired.load());
+    hplist.Collect(true);
+    assert(hplist.RetiredCount() == 0);
+    assert(hplist.RetiredBytes() == 0);
+    assert(t13_reclaimed.load() == 16);
+
+    // Reclaim functions run by a bulk retire retire to other lists,
+    // the remainder of the bulk retire is added to the batch of this list.
+    HazardPointerList<std::string>   bulk;
+    bulk.SetInlineCollect(8);
+    for (auto& other : t13_others)
+        other = new HazardPointerList<std::string>();
+    std::string* bulk_strs[12];
+    for (auto& s : bulk_strs)
+        s = new std::string("retired");
+    ok = bulk.Retire(bulk_strs, 12, t13_retire_other);
+    assert(ok);
+    assert(t13_reclaimed.load() == 24);
+    bulk.FlushRetired();
+    bulk.Collect(true);
+    assert(t13_reclaimed.load() == 28);
+    for (auto other : t13_others)
+    {
+        other->FlushRetired();
+        delete other;
+    }
+}
+
+// Snapshot gauges are always maintained, counters only with
+// HAZARD_POINTER_STATS.
+void t14()
+{
+    CollectorThread thCollector;
+    HazardPointerList<std::string>   hplist(&thCollector);
+    hplist.SetScanThreshold(0, 1024);
+    HazardDomainStats stats = hplist.Snapshot();
+    assert(stats.retired == 0 && stats.retired_bytes == 0);
+    {
+        HazardPointer<std::string> hp(hplist);
+        std::string* str = new std::string("protected");
+        hp.Acquire(&str);
+        hplist.Retire(str);
+        for (int x = 0; x < 3; x++)
+            hplist.Retire(new std::string("retired"));
+        hplist.FlushRetired();
+        stats = hplist.Snapshot();
+        assert(stats.nodes >= 1);
+        assert(stats.retired == 4);
+        assert(stats.retired_bytes == 4 * sizeof(std::string));
+        hplist.Collect(true);
+        stats = hplist.Snapshot();
+        assert(stats.retired == 1);
+        assert(stats.scans.reclaimed == 3);
+    }
+    hplist.Collect(true);
+    stats = hplist.Snapshot();
+    assert(stats.retired == 0);
+    assert(stats.free_nodes >= 1);
+    uint64_t latencies = 0;
+    for (unsigned ix = 0; ix < HazardLatencyHistogram::k_BUCKETS; ++ix)
+        latencies += stats.latency.buckets[ix];
+    CollectorStats cstats = thCollector.Snapshot();
+#if     defined(HAZARD_POINTER_STATS)
+    assert(stats.objects_retired == 4);
+    assert(latencies == 4);
+    assert(cstats.signals == 0 || cstats.wakeups >= 1);
+#else
+    assert(stats.objects_retired == 0);
+    assert(latencies == 0);
+    assert(cstats.rounds == 0 && cstats.signals == 0);
+#endif
+    assert(HazardLatencyHistogram::Bucket(0) == 0);
+    assert(HazardLatencyHistogram::Bucket(1) == 0);
+    assert(HazardLatencyHistogram::Bucket(1000) == 9);
+    assert(HazardLatencyHistogram::Bucket(~0ULL) == HazardLatencyHistogram::k_BUCKETS - 1);
+}
+
+// Readers always observe a consistent version, whilst writers publish and
+// update concurrently.
+struct Config {
+    static std::atomic<int> live;
+    unsigned version;
+    unsigned check;
+    explicit Config(unsigned v):version(v), check(~v) { ++live; }
+    Config(const Config& other):version(other.version), check(other.check) { ++live; }
+    ~Config() { check = 0; --live; }
+};
+std::atomic<int> Config::live(0);
+
+void t15()
+{
+    {
+        HazardPointerList<Config>   hplist;
+        hplist.SetScanThreshold(0, 16);
+        hp_snapshot<Config> snapshot(hplist, new Config(0));
+        {
+            hp_snapshot<Config>::view v0 = snapshot.load();
+            snapshot.publish(new Config(1));
+            hplist.FlushRetired();
+            hplist.Collect(true);
+            // The replaced version is protected by the view.
+            assert(v0->version == 0 && v0->check == ~0U);
+            assert(Config::live.load() == 2);
+            v0.reset();
+            assert(!v0);
+            hplist.Collect(true);
+            assert(Config::live.load() == 1);
+        }
+        bool updated = snapshot.update([](const Config*) -> Config* { return NULL; });
+        assert(!updated);
+        assert(snapshot.load()->version == 1);
+
+        const unsigned k_UPDATES = 2000;
+        std::atomic<bool> done(false);
+        std::vector<std::thread> threads;
+        for (int th = 0; th < 2; th++)
+        {
+            threads.emplace_back([&snapshot, &hplist, &done]{
+                HazardPointer<Config> hp(hplist);
+                unsigned last = 0;
+                while (!done.load())
+                {
+                    const Config* config = snapshot.load(hp);
+                    assert(config->check == ~config->version);
+                    // Versions are only incremented.
+                    assert(config->version >= last);
+                    last = config->version;
+                }
+            });
+        }
+        for (int th = 0; th < 2; th++)
+        {
+            threads.emplace_back([&snapshot, &hplist]{
+                for (unsigned ix = 0; ix < k_UPDATES; ++ix)
+                {
+                    bool updated = snapshot.copy_update([](Config& config) {
+                        ++config.version;
+                        config.check = ~config.version;
+                        return true;
+                    });
+                    assert(updated);
+                }
+                hplist.FlushRetired();
+            });
+        }
+        for (unsigned th = 2; th < threads.size(); ++th)
+            threads[th].join();
+        done = true;
+        threads[0].join();
+        threads[1].join();
+        assert(snapshot.load()->version == 1 + 2 * k_UPDATES);
+    }
+    assert(Config::live.load() == 0);
+
+    // Without a hazard pointer record, loads are unbound and updates fail.
+    {
+        HazardPointerList<Config>   limited;
+        limited.SetNodeLimits(0, 1, HazardNodePolicy::k_FAIL);
+        hp_snapshot<Config> snapshot(limited, new Config(0));
+        {
+            HazardPointer<Config> hp(limited);
+            assert(hp.IsBound());
+            hp_snapshot<Config>::view v0 = snapshot.load();
+            assert(!v0.IsBound() && !v0);
+            bool invoked = false;
+            bool updated = snapshot.update([&invoked](const Config*) -> Config* {
+                invoked = true;
+                return new Config(1);
+            });
+            assert(!updated && !invoked);
+            assert(snapshot.load(hp)->version == 0);
+        }
+        hp_snapshot<Config>::view v0 = snapshot.load();
+        assert(v0.IsBound() && v0->version == 0);
+    }
+    assert(Config::live.load() == 0);
+}
+
+static std::atomic<int> t16_reclaimed(0);
+
+static void t16_reclaim(std::string* str)
+{
+    delete str;
+    t16_reclaimed.fetch_add(1);
+}
+
+// Thread caches of nodes and retired objects, are returned on thread exit
+// and on eviction, and dropped if their list no longer exists.
+void t16()
+{
+    // Nodes cached by a thread are returned to the free list on exit.
+    HazardPointerList<std::string>   hplist;
+    std::thread th([&hplist]{
+        {
+            HazardPointer<std::string> hp(hplist);
+            assert(hp.IsBound());
+        }
+        HazardDomainStats stats = hplist.Snapshot();
+        assert(stats.free_nodes < stats.nodes);
+    });
+    th.join();
+    HazardDomainStats stats = hplist.Snapshot();
+    assert(stats.nodes >= 1);
+    assert(stats.free_nodes == stats.nodes);
+
+    // A thread using more lists than it has caches for evicts the cache
+    // of the least recently assigned list.
+    std::vector<HazardPointerList<std::string>*> lists;
+    for (int ix = 0; ix < 5; ix++)
+        lists.push_back(new HazardPointerList<std::string>());
+    th = std::thread([&lists]{
+        for (auto hplist : lists)
+        {
+            HazardPointer<std::string> hp(*hplist);
+            assert(hp.IsBound());
+        }
+        HazardDomainStats evicted = lists.front()->Snapshot();
+        assert(evicted.free_nodes == evicted.nodes);
+        for (size_t ix = 1; ix < lists.size(); ix++)
+        {
+            HazardDomainStats cached = lists[ix]->Snapshot();
+            assert(cached.free_nodes < cached.nodes);
+        }
+    });
+    th.join();
+    for (auto hplist : lists)
+    {
+        stats = hplist->Snapshot();
+        assert(stats.free_nodes == stats.nodes);
+        delete hplist;
+    }
+
+    // A thread exiting after its list was destroyed deletes the objects
+    // in its batch, and leaves its cached nodes.
+    HazardPointerList<std::string>* dead = new HazardPointerList<std::string>();
+    std::atomic<int> phase(0);
+    th = std::thread([dead, &phase]{
+        {
+            HazardPointer<std::string> hp(*dead);
+            assert(hp.IsBound());
+        }
+        dead->Retire(new std::string("retired"), t16_reclaim);
+        dead->Retire(new std::string("retired"), t16_reclaim);
+        phase = 1;
+        while (phase.load() != 2)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    while (phase.load() != 1)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    delete dead;
+    assert(t16_reclaimed.load() == 0);
+    phase = 2;
+    th.join();
+    assert(t16_reclaimed.load() == 2);
+}
+
     } // namespace concurrent
 } // namespace benedias
 
@@ -213,6 +1147,20 @@ int main(int argc, char** argv)
     benedias::concurrent::t0();
     benedias::concurrent::t1();
     benedias::concurrent::t2();
+    benedias::concurrent::t3();
+    benedias::concurrent::t4();
+    benedias::concurrent::t5();
+    benedias::concurrent::t6();
+    benedias::concurrent::t7();
+    benedias::concurrent::t8();
+    benedias::concurrent::t9();
+    benedias::concurrent::t10();
+    benedias::concurrent::t11();
+    benedias::concurrent::t12();
+    benedias::concurrent::t13();
+    benedias::concurrent::t14();
+    benedias::concurrent::t15();
+    benedias::concurrent::t16();
     return 0;
 }
 
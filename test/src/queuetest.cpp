@@ -0,0 +1,401 @@
+/*
+
+Copyright (C) 2016  Blaise Dias
+
+This file is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This file is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this file.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <assert.h>
+#include "bdlock.h"
+#include "ms_queue.hpp"
+#include "mpmc_ring.hpp"
+
+using benedias::fu_lock;
+using benedias::concurrent::mpmc_ring;
+using benedias::concurrent::ms_queue;
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Tracked {
+    static std::atomic<int> live;
+    std::unique_ptr<unsigned> value;
+    Tracked() { ++live; }
+    explicit Tracked(unsigned v):value(new unsigned(v)) { ++live; }
+    Tracked(Tracked&& other):value(std::move(other.value)) { ++live; }
+    Tracked& operator=(Tracked&& other) { value = std::move(other.value); return *this; }
+    ~Tracked() { --live; }
+};
+std::atomic<int> Tracked::live(0);
+
+// FIFO order, move only items, and destruction of the items remaining
+// in the queue.
+static void ms_queue_test()
+{
+    std::cout << "ms_queue Test." << std::endl;
+    {
+        ms_queue<Tracked> queue;
+        Tracked item;
+        assert(queue.empty());
+        bool popped = queue.try_pop(item);
+        assert(!popped);
+        for (unsigned ix = 0; ix < 100; ++ix)
+            queue.push(Tracked(ix));
+        assert(!queue.empty());
+        for (unsigned ix = 0; ix < 90; ++ix)
+        {
+            popped = queue.try_pop(item);
+            assert(popped);
+            assert(*item.value == ix);
+        }
+    }
+    assert(Tracked::live.load() == 0);
+
+    // Producers and consumers, every item is dequeued exactly once, and
+    // the items of each producer in order.
+    const unsigned k_PRODUCERS = 3;
+    const unsigned k_CONSUMERS = 3;
+    const unsigned k_ITEMS = 20000;
+    ms_queue<uint64_t> queue(64);
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> sum(0);
+    std::atomic<unsigned> count(0);
+    for (unsigned th = 0; th < k_CONSUMERS; ++th)
+    {
+        threads.emplace_back([&]{
+            uint64_t last[k_PRODUCERS] = {};
+            uint64_t item;
+            while (queue.pop(item))
+            {
+                uint64_t producer = item >> 32;
+                uint64_t seq = item & 0xffffffff;
+                assert(producer < k_PRODUCERS);
+                assert(seq > last[producer]);
+                last[producer] = seq;
+                sum += seq;
+                ++count;
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (uint64_t th = 0; th < k_PRODUCERS; ++th)
+    {
+        producers.emplace_back([&queue, th]{
+            for (uint64_t seq = 1; seq <= k_ITEMS; ++seq)
+                queue.push((th << 32) | seq);
+        });
+    }
+    for (auto& th : producers)
+        th.join();
+    queue.close();
+    for (auto& th : threads)
+        th.join();
+    assert(count.load() == k_PRODUCERS * k_ITEMS);
+    assert(sum.load() == (uint64_t)k_PRODUCERS * k_ITEMS * (k_ITEMS + 1) / 2);
+    assert(queue.empty());
+}
+
+// Full and empty rings, batches, deadlines, and closing.
+static void mpmc_ring_test()
+{
+    std::cout << "mpmc_ring Test." << std::endl;
+    bool thrown = false;
+    try {
+        mpmc_ring<int> bad(12);
+    } catch (std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+    {
+        mpmc_ring<Tracked> ring(8);
+        Tracked item;
+        bool ok = ring.try_pop(item);
+        assert(!ok);
+        for (unsigned ix = 0; ix < 8; ++ix)
+        {
+            ok = ring.try_push(Tracked(ix));
+            assert(ok);
+        }
+        Tracked extra(8);
+        ok = ring.try_push(std::move(extra));
+        assert(!ok);
+        assert(extra.value && *extra.value == 8);
+        assert(ring.size() == 8);
+        for (unsigned ix = 0; ix < 4; ++ix)
+        {
+            ok = ring.try_pop(item);
+            assert(ok);
+            assert(*item.value == ix);
+        }
+        // Wraps around, and stops at the first full slot.
+        Tracked batch[6];
+        for (unsigned ix = 0; ix < 6; ++ix)
+            batch[ix] = Tracked(100 + ix);
+        size_t n = ring.try_push_n(batch, 6);
+        assert(n == 4);
+        Tracked out[16];
+        n = ring.try_pop_n(out, 16);
+        assert(n == 8);
+        assert(*out[0].value == 4 && *out[4].value == 100 && *out[7].value == 103);
+        n = ring.try_push_n(batch + 4, 2);
+        assert(n == 2);
+    }
+    assert(Tracked::live.load() == 0);
+
+    {
+        mpmc_ring<int> ring(2);
+        int value = 0;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = ring.pop_until(value, start + std::chrono::milliseconds(10));
+        assert(!ok);
+        assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(10));
+        ok = ring.push(1);
+        assert(ok);
+        ok = ring.push(2);
+        assert(ok);
+        ok = ring.push_until(3, std::chrono::steady_clock::now()
+                + std::chrono::milliseconds(5));
+        assert(!ok);
+        int out[4];
+        size_t n = ring.pop_n_until(out, 4, std::chrono::steady_clock::now());
+        assert(n == 2);
+
+        std::thread consumer([&ring]{
+            int item;
+            while (ring.pop(item))
+                assert(item == 7);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        ok = ring.push(7);
+        assert(ok);
+        ring.close();
+        consumer.join();
+        ok = ring.push(8);
+        assert(!ok);
+    }
+
+    // Producers and consumers with blocking single and batched
+    // operations, every item is popped exactly once, and the items of
+    // each producer in order.
+    const unsigned k_PRODUCERS = 3;
+    const unsigned k_CONSUMERS = 3;
+    const unsigned k_ITEMS = 30000;
+    mpmc_ring<uint64_t> ring(16);
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> sum(0);
+    std::atomic<unsigned> count(0);
+    for (unsigned th = 0; th < k_CONSUMERS; ++th)
+    {
+        threads.emplace_back([&, th]{
+            uint64_t last[k_PRODUCERS] = {};
+            uint64_t items[8];
+            size_t n;
+            while ((n = (th & 1) ? ring.pop_n(items, 8) : ring.pop(items[0])) != 0)
+            {
+                for (size_t ix = 0; ix < n; ++ix)
+                {
+                    uint64_t producer = items[ix] >> 32;
+                    uint64_t seq = items[ix] & 0xffffffff;
+                    assert(producer < k_PRODUCERS);
+                    assert(seq > last[producer]);
+                    last[producer] = seq;
+                    sum += seq;
+                    ++count;
+                }
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (uint64_t th = 0; th < k_PRODUCERS; ++th)
+    {
+        producers.emplace_back([&ring, th]{
+            uint64_t items[5];
+            for (uint64_t seq = 1; seq <= k_ITEMS; )
+            {
+                if (th & 1)
+                {
+                    for (unsigned ix = 0; ix < 5; ++ix)
+                        items[ix] = (th << 32) | seq++;
+                    size_t pushed = ring.push_n(items, 5);
+                    assert(pushed == 5);
+                }
+                else
+                {
+                    bool pushed = ring.push((th << 32) | seq++);
+                    assert(pushed);
+                }
+            }
+        });
+    }
+    for (auto& th : producers)
+        th.join();
+    ring.close();
+    for (auto& th : threads)
+        th.join();
+    assert(count.load() == k_PRODUCERS * k_ITEMS);
+    assert(sum.load() == (uint64_t)k_PRODUCERS * k_ITEMS * (k_ITEMS + 1) / 2);
+}
+
+// A std::deque protected by a fu_lock, for comparison.
+template <typename T> class locked_deque {
+    fu_lock lock;
+    std::deque<T> items;
+ public:
+    void push(const T& value)
+    {
+        std::lock_guard<fu_lock> lockg(lock);
+        items.push_back(value);
+    }
+
+    bool try_pop(T& value)
+    {
+        std::lock_guard<fu_lock> lockg(lock);
+        if (items.empty())
+            return false;
+        value = items.front();
+        items.pop_front();
+        return true;
+    }
+};
+
+struct ring_1024: public mpmc_ring<uint64_t> {
+    ring_1024():mpmc_ring<uint64_t>(1024) {}
+};
+
+// Producers push timestamps, consumers pop them, and sample the latency
+// from push to pop.
+template <typename Q> static void bench(const char* name, unsigned nproducers,
+        unsigned nconsumers, unsigned items)
+{
+    Q queue;
+    std::vector<std::thread> threads;
+    std::vector<std::vector<uint64_t>> latencies(nconsumers);
+    std::atomic<unsigned> remaining(nproducers * items);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned th = 0; th < nconsumers; ++th)
+    {
+        threads.emplace_back([&queue, &remaining, &latencies, th]{
+            uint64_t stamp;
+            unsigned n = 0;
+            while (remaining.load(std::memory_order_relaxed) != 0)
+            {
+                if (!queue.try_pop(stamp))
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                remaining.fetch_sub(1, std::memory_order_relaxed);
+                if ((++n & 15) == 0)
+                    latencies[th].push_back(now_ns() - stamp);
+            }
+        });
+    }
+    for (unsigned th = 0; th < nproducers; ++th)
+    {
+        threads.emplace_back([&queue, items]{
+            for (unsigned ix = 0; ix < items; ++ix)
+                queue.push(now_ns());
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+
+    std::vector<uint64_t> all;
+    for (auto& lat : latencies)
+        all.insert(all.end(), lat.begin(), lat.end());
+    std::sort(all.begin(), all.end());
+    std::cout << " " << name << " "
+        << (nproducers * items) / elapsed.count() / 1e6 << " M items/s";
+    if (!all.empty())
+    {
+        std::cout << ", latency p50 " << all[all.size() / 2] / 1000.0
+            << " us, p99 " << all[all.size() * 99 / 100] / 1000.0 << " us";
+    }
+    std::cout << std::endl;
+}
+
+// Stage handoff in batches, producers push_n and consumers pop_n.
+static void bench_batched(unsigned nproducers, unsigned nconsumers,
+        unsigned items, unsigned batch)
+{
+    mpmc_ring<uint64_t> ring(1024);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned th = 0; th < nconsumers; ++th)
+    {
+        threads.emplace_back([&ring, batch]{
+            std::vector<uint64_t> out(batch);
+            while (ring.pop_n(out.data(), batch) != 0)
+            {
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (unsigned th = 0; th < nproducers; ++th)
+    {
+        producers.emplace_back([&ring, items, batch]{
+            std::vector<uint64_t> in(batch);
+            for (unsigned ix = 0; ix < items; ix += batch)
+            {
+                for (unsigned jx = 0; jx < batch; ++jx)
+                    in[jx] = ix + jx;
+                ring.push_n(in.data(), batch);
+            }
+        });
+    }
+    for (auto& th : producers)
+        th.join();
+    ring.close();
+    for (auto& th : threads)
+        th.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << " mpmc_ring batches of " << batch << " "
+        << (nproducers * items) / elapsed.count() / 1e6 << " M items/s" << std::endl;
+}
+
+static void bench_all(unsigned nproducers, unsigned nconsumers, unsigned items)
+{
+    std::cout << "Benchmark " << nproducers << " producers, " << nconsumers
+        << " consumers, " << items << " items per producer." << std::endl;
+    bench<ms_queue<uint64_t>>("ms_queue            ", nproducers, nconsumers, items);
+    bench<ring_1024>("mpmc_ring           ", nproducers, nconsumers, items);
+    bench<locked_deque<uint64_t>>("fu_lock + std::deque", nproducers, nconsumers, items);
+    bench_batched(nproducers, nconsumers, items, 32);
+}
+
+int main(int argc, char* argv[])
+{
+    ms_queue_test();
+    mpmc_ring_test();
+    std::cout << "--------------------" << std::endl;
+    bench_all(1, 1, 200000);
+    bench_all(4, 4, 100000);
+    std::cout << "--------------------" << std::endl;
+    std::cout << "All Done. " << std::endl;
+}
@@ -30,8 +30,15 @@ along with sqzbsrv.  If not, see <http://www.gnu.org/licenses/>.
 #include <chrono>
 #include <thread>
 #include <memory>
+#include <atomic>
+#include <vector>
 #include <assert.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 #include "semaphore.hpp"
+#include "bdfutex.h"
 
 using std::string;
 using namespace std::chrono_literals;
@@ -119,8 +126,227 @@ void bs_test()
     th2.join();
 }
 
+static void csemtest_consumer(benedias::semaphore& sem, unsigned batch,
+        unsigned total, std::atomic<unsigned>& consumed)
+{
+    while (consumed.load() < total)
+    {
+        if (sem.wait_for(100ms, batch))
+            consumed += batch;
+    }
+}
+
+void cs_test()
+{
+    std::cout << "Counting Semaphore Test. " << std::endl;
+    benedias::semaphore sem(2);
+    assert(sem.get_value() == 2);
+    bool acquired = sem.try_acquire(3);
+    assert(!acquired);
+    acquired = sem.try_acquire(2);
+    assert(acquired);
+    acquired = sem.try_wait();
+    assert(!acquired);
+    sem.post(5);
+    assert(sem.get_value() == 5);
+    sem.wait(4);
+    assert(sem.get_value() == 1);
+
+    // test:timed wait expires {
+    auto start = std::chrono::steady_clock::now();
+    acquired = sem.wait_for(200ms, 2);
+    assert(!acquired);
+    auto end = std::chrono::steady_clock::now();
+    assert(end - start >= 200ms);
+    assert(sem.get_value() == 1);
+    // test:timed wait expires }
+    acquired = sem.try_acquire();
+    assert(acquired);
+
+    // test:batched posts satisfy single and bulk waiters {
+    const unsigned total = 30000;
+    std::atomic<unsigned> consumed(0);
+    std::vector<std::thread> consumers;
+    for (unsigned i = 0; i < 4; ++i)
+        consumers.emplace_back(csemtest_consumer, std::ref(sem), 1 + (i % 3),
+                total, std::ref(consumed));
+    for (unsigned posted = 0; posted < total + 4 * 3; posted += 6)
+    {
+        sem.post(6);
+        if (0 == (posted % 600))
+            std::this_thread::yield();
+    }
+    for (auto &th : consumers)
+        th.join();
+    assert(consumed.load() >= total);
+    // test:batched posts satisfy single and bulk waiters }
+}
+
+static bool fd_readable(int fd)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return 1 == poll(&pfd, 1, 0);
+}
+
+void efd_bs_test()
+{
+    std::cout << "eventfd Binary Semaphore Test. " << std::endl;
+    benedias::eventfd_binary_semaphore ebs;
+    // test:unarmed post does not signal the fd {
+    ebs.post();
+    assert(!fd_readable(ebs.fd()));
+    bool signalled = ebs.try_wait();
+    assert(signalled);
+    signalled = ebs.try_wait();
+    assert(!signalled);
+    // test:unarmed post does not signal the fd }
+
+    // test:armed post signals the fd once {
+    signalled = ebs.arm();
+    assert(!signalled);
+    assert(!fd_readable(ebs.fd()));
+    ebs.post();
+    ebs.post();
+    assert(fd_readable(ebs.fd()));
+    signalled = ebs.poll_consume();
+    assert(signalled);
+    assert(!fd_readable(ebs.fd()));
+    signalled = ebs.poll_consume();
+    assert(!signalled);
+    // test:armed post signals the fd once }
+
+    // test:arm reports a post which preceded it {
+    ebs.disarm();
+    ebs.post();
+    signalled = ebs.arm();
+    assert(signalled);
+    signalled = ebs.try_wait();
+    assert(signalled);
+    // test:arm reports a post which preceded it }
+
+    // test:poll from another thread {
+    std::thread th([&ebs]{
+            std::this_thread::sleep_for(100ms);
+            ebs.post();
+    });
+    struct pollfd pfd = {ebs.fd(), POLLIN, 0};
+    int ready = poll(&pfd, 1, 5000);
+    assert(1 == ready);
+    signalled = ebs.poll_consume();
+    assert(signalled);
+    th.join();
+    ebs.disarm();
+    // test:poll from another thread }
+
+    // test:thread wait {
+    std::thread th2([&ebs]{
+            std::this_thread::sleep_for(100ms);
+            ebs.post();
+    });
+    ebs.wait();
+    assert(0 == ebs.get_value());
+    th2.join();
+    // test:thread wait }
+}
+
+// returns true if thread tid of this process is sleeping, for example
+// parked on a futex.
+static bool thread_sleeping(pid_t tid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", (int)tid);
+    std::ifstream stat(path);
+    std::string line;
+    std::getline(stat, line);
+    // The state follows the parenthesised command name.
+    size_t pos = line.rfind(')');
+    return pos != std::string::npos && pos + 2 < line.size() && line[pos + 2] == 'S';
+}
+
+void ec_test()
+{
+    std::cout << "eventcount Test. " << std::endl;
+    // test:notify with no waiters does not advance the epoch {
+    {
+        benedias::eventcount ec;
+        ec.notify();
+        int key = ec.prepare_wait();
+        assert(0 == key);
+        // test:cancel after prepare {
+        // The condition became true, the waiter does not wait, and the
+        // waiters bit remains set, so the next notify advances the epoch.
+        ec.cancel_wait();
+        ec.notify();
+        int next = ec.prepare_wait();
+        assert(key != next);
+        ec.cancel_wait();
+        // test:cancel after prepare }
+    }
+    // test:notify with no waiters does not advance the epoch }
+
+    // test:notify between prepare and commit, commit does not wait {
+    {
+        benedias::eventcount ec;
+        int key = ec.prepare_wait();
+        ec.notify();
+        ec.commit_wait(key);
+    }
+    // test:notify between prepare and commit, commit does not wait }
+
+    // test:timed commit without notify times out {
+    {
+        benedias::eventcount ec;
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += 10000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+        int key = ec.prepare_wait();
+        bool notified = ec.commit_wait_until(key, &deadline);
+        assert(!notified);
+    }
+    // test:timed commit without notify times out }
+
+    // test:waiter parked before notify is woken {
+    {
+        benedias::eventcount ec;
+        std::atomic<bool> condition(false);
+        std::atomic<pid_t> waiter_tid(0);
+        std::thread waiter([&]{
+            waiter_tid = syscall(SYS_gettid);
+            while (!condition.load())
+            {
+                int key = ec.prepare_wait();
+                if (condition.load())
+                {
+                    ec.cancel_wait();
+                    break;
+                }
+                ec.commit_wait(key);
+            }
+        });
+        while (0 == waiter_tid.load())
+            std::this_thread::yield();
+        while (!thread_sleeping(waiter_tid.load()))
+            std::this_thread::yield();
+        condition = true;
+        ec.notify();
+        waiter.join();
+    }
+    // test:waiter parked before notify is woken }
+}
+
 int main(int argc, char* argv[])
 {
     bs_test();
     std::cout << "--------------------" << std::endl;
+    cs_test();
+    std::cout << "--------------------" << std::endl;
+    efd_bs_test();
+    std::cout << "--------------------" << std::endl;
+    ec_test();
+    std::cout << "--------------------" << std::endl;
 }
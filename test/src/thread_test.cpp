@@ -23,6 +23,8 @@ extern void rwlock_test2();
 extern void rwlock_mw_test2();
 extern void rwlock_rmw_test2();
 extern void bs_test();
+extern void latch_test();
+extern void barrier_test();
 
 int main(int argc, char* argv[])
 {
@@ -36,6 +38,10 @@ int main(int argc, char* argv[])
     std::cout << "--------------------" << std::endl;
 //    rwlock_rmw_test2();
 //    std::cout << "--------------------" << std::endl;
+    latch_test();
+    std::cout << "--------------------" << std::endl;
+    barrier_test();
+    std::cout << "--------------------" << std::endl;
     std::cout << "All Done. " << std::endl;
 }
 